@@ -0,0 +1,258 @@
+// Measures the cost of picking a worker with power-of-two-choices against a least-loaded
+// scan, per pick, at a given number of workers. Then follows how the share of picks going
+// to one worker of ten drops when its latency degrades and returns once it recovers.
+// Then routes through a WorkerPool of that many workers from several threads, by the
+// published snapshot against the locked health scan routing used to make on every call,
+// reporting time and heap allocations per pick. Last, checks client affinity on that pool:
+// no worker may hold more than ceil(load factor x average) jobs as clients pile on, and
+// removing a worker may move only the clients that were on it, about 1/N of them. The
+// program exits with 1 if either check fails.
+//
+// Workers are never sent renders. For the first two parts their connections point at a
+// closed port and their load and latency are recorded by hand; for the pool, every worker
+// is a loopback address of one in-process server that answers health checks.
+//
+// Build with the master's worker_pool.cpp, load_balancer.cpp, the generated protos and
+// shared/include/AllocationCounter.cpp.
+//
+// Usage: load_balancer_bench [workers] [picks] [threads]
+#include "load_balancer.h"
+#include "AllocationCounter.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace RaycastMaster;
+
+namespace {
+
+std::vector<std::unique_ptr<WorkerConnection>> makeWorkers(int count, std::mt19937& random) {
+    // The connections fail their first health check against the closed port; have it give up
+    // at once, and keep that quiet
+    setenv("HEALTH_CHECK_TIMEOUT_SECONDS", "0", 1);
+    std::streambuf* errors = std::cerr.rdbuf(nullptr);
+    std::vector<std::unique_ptr<WorkerConnection>> workers;
+    for (int i = 0; i < count; i++) {
+        workers.push_back(std::make_unique<WorkerConnection>("127.0.0.1:1"));
+    }
+    std::cerr.rdbuf(errors);
+    unsetenv("HEALTH_CHECK_TIMEOUT_SECONDS");
+    
+    std::uniform_real_distribution<double> latencyMs(0.5, 2.0);
+    for (auto& worker : workers) {
+        for (int sample = 0; sample < 4; sample++) {
+            worker->RecordLatency(std::chrono::microseconds(static_cast<int64_t>(latencyMs(random) * 1000)));
+        }
+        for (int jobs = random() % 4; jobs > 0; jobs--) {
+            worker->IncrementActiveJobs();
+        }
+    }
+    return workers;
+}
+
+template <typename Pick>
+double nanosecondsPerPick(int picks, Pick pick) {
+    WorkerConnection* sink = nullptr;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < picks; i++) {
+        sink = pick();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    if (!sink) std::printf("no worker picked\n");
+    return std::chrono::duration<double, std::nano>(elapsed).count() / picks;
+}
+
+// Runs picks for duration, recording a round trip of degradedMs for worker 0 and of 1 ms for
+// the rest, and prints worker 0's share of the picks every half second
+void followShare(const std::vector<WorkerConnection*>& workers, double degradedMs, std::chrono::milliseconds duration,
+                 const char* phase) {
+    auto end = std::chrono::steady_clock::now() + duration;
+    while (std::chrono::steady_clock::now() < end) {
+        auto windowEnd = std::chrono::steady_clock::now() + std::chrono::milliseconds(500);
+        int picks = 0, first = 0;
+        while (std::chrono::steady_clock::now() < windowEnd) {
+            WorkerConnection* worker = LoadBalancer::PickPowerOfTwoChoices(workers);
+            bool isFirst = worker == workers[0];
+            double latencyMs = isFirst ? degradedMs : 1.0;
+            worker->RecordLatency(std::chrono::microseconds(static_cast<int64_t>(latencyMs * 1000)));
+            first += isFirst;
+            picks++;
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        std::printf("  %-10s worker 0 share %5.1f%% (peak latency %6.2f ms)\n", phase,
+                    100.0 * first / picks, workers[0]->GetPeakLatencyMs());
+    }
+}
+
+// Answers health checks, standing in for every worker of the pool
+class StatusService : public RaycastWorker::WorkerService::Service {
+public:
+    grpc::Status GetWorkerStatus(grpc::ServerContext*, const RaycastWorker::StatusRequest*,
+                                 RaycastWorker::WorkerStatus*) override {
+        return grpc::Status::OK;
+    }
+};
+
+// Splits picks across threads and prints the wall time and heap allocations per pick
+template <typename Pick>
+void routeFromThreads(const char* name, int threads, int picks, Pick pick) {
+    std::atomic<uint64_t> allocations{0};
+    std::vector<std::thread> running;
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < threads; t++) {
+        running.emplace_back([&, t] {
+            pick(t); // Warm the thread's caches before counting
+            uint64_t before = threadAllocationCount();
+            for (int i = 0; i < picks / threads; i++) {
+                if (!pick(i)) std::printf("no worker picked\n");
+            }
+            allocations += threadAllocationCount() - before;
+        });
+    }
+    for (auto& thread : running) {
+        thread.join();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    int done = picks / threads * threads;
+    std::printf("  %-22s %8.1f ns/pick %6.2f allocations/pick\n", name,
+                std::chrono::duration<double, std::nano>(elapsed).count() / done,
+                static_cast<double>(allocations.load()) / done);
+}
+
+// Routes jobs for a few busy clients, each job staying open, and returns the most any
+// worker held over ceil(factor x average jobs) at any point; 0 or less keeps the bound
+int64_t worstOverBound(WorkerPool& pool, LoadBalancer& balancer, double factor, int jobs) {
+    std::vector<WorkerConnection*> all = pool.GetAllWorkers();
+    std::vector<WorkerConnection*> open;
+    int64_t worst = std::numeric_limits<int64_t>::min();
+    for (int i = 0; i < jobs; i++) {
+        WorkerConnection* worker = balancer.GetWorkerForRequest("busy" + std::to_string(i % 8));
+        worker->IncrementActiveJobs();
+        open.push_back(worker);
+        int64_t bound = static_cast<int64_t>(std::ceil(factor * (i + 1) / all.size()));
+        for (WorkerConnection* each : all) {
+            worst = std::max(worst, each->GetActiveJobs() - bound);
+        }
+    }
+    for (WorkerConnection* worker : open) {
+        worker->DecrementActiveJobs();
+    }
+    return worst;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    int workerCount = argc > 1 ? std::atoi(argv[1]) : 1000;
+    int picks = argc > 2 ? std::atoi(argv[2]) : 1000000;
+    int threads = std::max(argc > 3 ? std::atoi(argv[3]) : 4, 1);
+    std::mt19937 random(42);
+    
+    auto owned = makeWorkers(workerCount, random);
+    std::vector<WorkerConnection*> workers;
+    for (auto& worker : owned) {
+        workers.push_back(worker.get());
+    }
+    
+    std::printf("%d workers, %d picks\n", workerCount, picks);
+    double p2c = nanosecondsPerPick(picks, [&] { return LoadBalancer::PickPowerOfTwoChoices(workers); });
+    double scan = nanosecondsPerPick(picks / 100 + 1, [&] {
+        return *std::min_element(workers.begin(), workers.end(), [](WorkerConnection* a, WorkerConnection* b) {
+            return a->GetActiveJobs() < b->GetActiveJobs();
+        });
+    });
+    std::printf("  power of two choices  %8.1f ns/pick\n", p2c);
+    std::printf("  least loaded scan     %8.1f ns/pick\n", scan);
+    
+    // Ten equal workers, then worker 0 slows to 20 ms, then recovers
+    std::printf("adaptation, 10 workers (fair share 10%%)\n");
+    auto tenOwned = makeWorkers(10, random);
+    std::vector<WorkerConnection*> ten;
+    for (auto& worker : tenOwned) {
+        while (worker->GetActiveJobs() > 0) {
+            worker->DecrementActiveJobs();
+        }
+        ten.push_back(worker.get());
+    }
+    followShare(ten, 1.0, std::chrono::milliseconds(1000), "steady");
+    followShare(ten, 20.0, std::chrono::milliseconds(1500), "degraded");
+    followShare(ten, 1.0, std::chrono::milliseconds(6000), "recovered");
+    
+    // The pool's workers are 127.0.x.y on the server's port, all the same server
+    StatusService service;
+    int port = 0;
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort("0.0.0.0:0", grpc::InsecureServerCredentials(), &port);
+    builder.RegisterService(&service);
+    std::unique_ptr<grpc::Server> server = builder.BuildAndStart();
+    
+    WorkerPool pool;
+    std::streambuf* output = std::cout.rdbuf(nullptr);
+    for (int i = 0; i < workerCount; i++) {
+        pool.AddWorker("127.0." + std::to_string(i / 250) + "." + std::to_string(i % 250 + 1) + ":" +
+                       std::to_string(port));
+    }
+    std::cout.rdbuf(output);
+    LoadBalancer balancer(&pool, LoadBalancingStrategy::POWER_OF_TWO_CHOICES);
+    std::vector<std::string> clients;
+    for (int i = 0; i < 1024; i++) {
+        clients.push_back("client" + std::to_string(i));
+    }
+    
+    std::printf("routing through a pool of %d healthy workers, %d threads\n", pool.GetActiveWorkers(), threads);
+    routeFromThreads("locked health scan", threads, picks / 100 + threads, [&](int) {
+        std::vector<WorkerConnection*> healthy;
+        for (WorkerConnection* worker : pool.GetAllWorkers()) {
+            if (worker->IsHealthy()) {
+                healthy.push_back(worker);
+            }
+        }
+        return LoadBalancer::PickPowerOfTwoChoices(healthy);
+    });
+    routeFromThreads("snapshot, p2c", threads, picks, [&](int) { return balancer.GetNextWorker(); });
+    const double loadFactor = 1.25;
+    balancer.SetAffinityLoadFactor(loadFactor);
+    routeFromThreads("snapshot, client ring", threads, picks,
+                     [&](int i) { return balancer.GetWorkerForRequest(clients[i % clients.size()]); });
+    
+    int poolWorkers = pool.GetActiveWorkers();
+    std::printf("client affinity, %d workers, load factor %.2f\n", poolWorkers, loadFactor);
+    int64_t over = worstOverBound(pool, balancer, loadFactor, poolWorkers * 4);
+    std::printf("  most jobs over ceil(factor x average): %lld\n", static_cast<long long>(over));
+    
+    // Where each of many idle clients lands before and after the first worker leaves
+    std::vector<std::string> endpoints;
+    for (int i = 0; i < poolWorkers * 20; i++) {
+        endpoints.push_back(balancer.GetWorkerForRequest("client" + std::to_string(i))->GetEndpoint());
+    }
+    std::string removed = pool.GetAllWorkers()[0]->GetEndpoint();
+    output = std::cout.rdbuf(nullptr);
+    pool.RemoveWorker(removed);
+    std::cout.rdbuf(output);
+    int moved = 0, movedFromOthers = 0, onRemoved = 0;
+    for (size_t i = 0; i < endpoints.size(); i++) {
+        std::string now = balancer.GetWorkerForRequest("client" + std::to_string(i))->GetEndpoint();
+        onRemoved += endpoints[i] == removed;
+        if (now != endpoints[i]) {
+            moved++;
+            movedFromOthers += endpoints[i] != removed;
+        }
+    }
+    std::printf("  removing a worker moved %.2f%% of %zu clients (1/N is %.2f%%, its share was %.2f%%), "
+                "%d from other workers\n", 100.0 * moved / endpoints.size(), endpoints.size(), 100.0 / poolWorkers,
+                100.0 * onRemoved / endpoints.size(), movedFromOthers);
+    
+    server->Shutdown();
+    bool passed = over <= 0 && movedFromOthers == 0 && moved == onRemoved;
+    std::printf("client affinity checks %s\n", passed ? "passed" : "FAILED");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <grpcpp/grpcpp.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "worker_service.pb.h"
+#include "worker_pool.h"
+#include "load_balancer.h"
+
+namespace RaycastMaster {
+
+// Half-open range of screen columns
+struct ColumnRange {
+    int start_column;
+    int end_column;
+};
+
+// Splits start..end into one range per weight, each as wide as its share of the weights
+// but at least one column wide while there are columns enough
+std::vector<ColumnRange> SplitColumnsByWeight(int start_column, int end_column, const std::vector<double>& weights);
+
+// DDA steps the workers took over the columns of a frame, summed per bucket of screen
+// columns as in their column_steps histograms, to predict where the next frame's work lies
+struct ColumnCosts {
+    int bucket_columns = 0;
+    int start_column = 0;
+    int end_column = 0;                // Columns counted; none until a whole frame has been
+    std::vector<uint64_t> bucket_steps; // From the bucket holding start_column
+    
+    bool Empty() const { return bucket_columns <= 0 || end_column <= start_column; }
+    
+    // Zeroes the counts, ready to add the responses for start..end
+    void Reset(int bucket_columns, int start_column, int end_column);
+    
+    // Adds the histogram of the response for columns. Returns false if it is missing or malformed.
+    bool Add(const ColumnRange& columns, const RaycastWorker::RenderResponse& response);
+};
+
+// Splits start..end into one range per weight, each with its share of the weights of the
+// steps costs predicts, so equal weights give each range an equal predicted step count.
+// Columns costs did not count are predicted at the average column. Without costs the split
+// is by width, as SplitColumnsByWeight.
+std::vector<ColumnRange> SplitColumnsByCost(int start_column, int end_column, const ColumnCosts& costs,
+                                            const std::vector<double>& weights);
+
+// Token bucket capping extra sends at a share of ordinary ones: each ordinary send earns
+// ratio of a token, each extra send spends a whole one, and at most max_tokens are banked.
+// The bucket starts full, so a burst can be covered before there is a record to earn from.
+class RequestBudget {
+private:
+    double ratio_;
+    double max_tokens_;
+    std::atomic<double> tokens_;
+    
+public:
+    RequestBudget(double ratio, double max_tokens) : ratio_(ratio), max_tokens_(max_tokens), tokens_(max_tokens) {}
+    
+    void Earn();
+    bool TrySpend();
+};
+
+// When a scatter duplicates a slow part onto a second worker
+struct HedgePolicy {
+    double percentile = 0.0; // Of the worker's recent round trips; 0 never hedges
+    LoadBalancer* load_balancer = nullptr;
+    RequestBudget* budget = nullptr;
+};
+
+// One column range of a frame, in flight on one worker
+struct FramePart {
+    ColumnRange columns;
+    WorkerConnection* worker = nullptr;
+    RaycastWorker::RenderRequest request;
+    RaycastWorker::RenderResponse response;
+    grpc::Status status;
+    int64_t elapsed_ms = 0;
+    int attempts = 0;
+    int retries = 0;                                  // Sends to another worker after a failure
+    WorkerConnection* synced_worker = nullptr;        // Last worker the map was synced to for it
+    std::chrono::system_clock::time_point deadline;   // For every send of the part
+    bool in_flight = false;
+    
+    std::unique_ptr<grpc::ClientContext> context;
+    std::unique_ptr<grpc::ClientAsyncResponseReader<RaycastWorker::RenderResponse>> reader;
+    std::chrono::steady_clock::time_point sent_at;
+    std::chrono::steady_clock::time_point completed_at; // When the queue delivered the answer
+    
+    // Hedging: the duplicate sent when the part is still out at hedge_at, and on a duplicate,
+    // the part it stands in for. A part is finished once either call has its answer.
+    std::chrono::steady_clock::time_point hedge_at;
+    std::unique_ptr<FramePart> hedge;
+    FramePart* hedge_of = nullptr;
+    bool finished = false;
+    bool hedge_won = false; // Waiting on the cancelled first call before taking the hedge's answer
+};
+
+// Renders the column ranges of a frame on several workers at once through async stubs,
+// handing each range back as soon as its worker answers. A range still out past the hedge
+// policy's percentile of its worker's latency is sent to a second worker as well, and the
+// first answer wins. The completion queue and parts are reused from frame to frame; a
+// scatter serves one thread at a time.
+//
+// A thread of the scatter's own takes answers off the queue as they arrive and notes the
+// time, so round trips are measured to the answer rather than to whenever the caller next
+// asks for a part, which may be after it has written the previous one out.
+class FrameScatter {
+private:
+    grpc::CompletionQueue cq_;
+    std::mutex completed_mutex_;
+    std::condition_variable completed_ready_;
+    std::deque<FramePart*> completed_; // Calls the poller has taken off the queue, oldest first
+    std::thread poller_;               // Last, so it starts once the rest is constructed
+    
+
+    std::vector<std::unique_ptr<FramePart>> parts_;
+    size_t part_count_ = 0;
+    int pending_ = 0;        // Parts not yet returned by Next
+    int calls_in_flight_ = 0; // Calls the queue still owes, cancelled losers included
+    std::vector<FramePart*> failed_to_send_; // Finished without reaching a worker
+    const HedgePolicy* hedging_ = nullptr;
+    
+public:
+    FrameScatter();
+    ~FrameScatter();
+    
+    FrameScatter(const FrameScatter&) = delete;
+    FrameScatter& operator=(const FrameScatter&) = delete;
+    
+    // Hedges parts sent from now on by policy; nullptr turns hedging off
+    void SetHedgePolicy(const HedgePolicy* policy) { hedging_ = policy; }
+    
+    // Sends ranges[i] to workers[i], each as a copy of base with its columns, all to be done
+    // by deadline. The previous frame's parts must all have been returned by Next.
+    void Start(const RaycastWorker::RenderRequest& base, const std::vector<ColumnRange>& ranges,
+               const std::vector<WorkerConnection*>& workers, std::chrono::system_clock::time_point deadline);
+    
+    // Sends a finished part again, to worker, with its request as it now stands and its
+    // original deadline
+    void Resend(FramePart* part, WorkerConnection* worker);
+    
+    // Blocks until the next part finishes and returns it, or returns nullptr once none are left
+    FramePart* Next();
+    
+    // Asks the workers to drop every part still in flight; Next still returns each of them
+    void CancelPending();
+    
+    // Cancels every part still out and waits for them all, leaving the scatter idle for the
+    // next frame without returning them
+    void Reset();
+    
+    int GetPending() const { return pending_; }
+    
+    // Parts of the current frame, in the order of the ranges given to Start
+    size_t GetPartCount() const { return part_count_; }
+    FramePart* GetPart(size_t index) const { return parts_[index].get(); }
+    
+private:
+    void Send(FramePart* part);
+    
+    // Starts the call for part, or for its hedge, to call->worker. Returns false if the
+    // worker is not connected.
+    bool StartCall(FramePart* call, const RaycastWorker::RenderRequest& request);
+    
+    // Sends a hedge for every part out past its hedge time that the budget allows
+    void HedgeSlowParts(std::chrono::steady_clock::time_point now);
+    
+    // Earliest hedge time of the parts still out, or time_point::max() if none will hedge
+    std::chrono::steady_clock::time_point NextHedgeTime() const;
+    
+    // Takes calls off the queue until it shuts down, noting when each one arrived
+    void Poll();
+    
+    // Waits until the poller has a call, or until the given time. Returns nullptr on timeout.
+    FramePart* WaitForCall(std::chrono::steady_clock::time_point until);
+    
+    // Handles a call the queue returned. Returns its part if that finishes the part.
+    FramePart* Complete(FramePart* call);
+    
+    // Waits out the cancelled losers still in flight so their parts can be reused
+    void DrainCalls();
+};
+
+} // namespace RaycastMaster
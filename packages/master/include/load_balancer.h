@@ -5,6 +5,9 @@
 #include <atomic>
 #include <random>
 #include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <string>
 
 #include "worker_pool.h"
 
@@ -14,16 +17,33 @@ enum class LoadBalancingStrategy {
     ROUND_ROBIN,
     LEAST_LOADED,
     RANDOM,
-    WEIGHTED_ROUND_ROBIN
+    WEIGHTED_ROUND_ROBIN,
+    POWER_OF_TWO_CHOICES
 };
 
+// Strategy named by name as in LOAD_BALANCING_STRATEGY (round_robin, least_loaded, random,
+// weighted_round_robin or p2c), or fallback for any other name
+LoadBalancingStrategy ParseLoadBalancingStrategy(const std::string& name, LoadBalancingStrategy fallback);
+
 class LoadBalancer {
 private:
     WorkerPool* worker_pool_;
     LoadBalancingStrategy strategy_;
     std::atomic<size_t> round_robin_index_{0};
-    std::mt19937 random_generator_;
-    std::uniform_int_distribution<size_t> random_distribution_;
+    
+    // Consistent hash ring for client affinity, built once for each snapshot of the workers
+    static constexpr int RING_VIRTUAL_NODES = 100; // Points per worker
+    struct RingNode {
+        uint64_t hash;
+        WorkerConnection* worker;
+    };
+    struct HashRing {
+        std::shared_ptr<const WorkerSnapshot> snapshot; // Workers the ring was built from
+        std::vector<RingNode> nodes;                    // Sorted by hash
+    };
+    double affinity_load_factor_ = 0.0;
+    std::mutex ring_mutex_;
+    std::shared_ptr<const HashRing> ring_; // Latest built, under ring_mutex_
     
 public:
     explicit LoadBalancer(WorkerPool* worker_pool, 
@@ -32,23 +52,57 @@ public:
     
     // Worker selection
     WorkerConnection* GetNextWorker();
-    WorkerConnection* GetWorkerForRequest(const std::string& request_id = "");
+    WorkerConnection* GetWorkerForRequest(const std::string& client_id = "");
+    
+    // count workers for a request from client_id. With an affinity load factor set, client
+    // affinity takes precedence over the strategy: the workers are the distinct ones
+    // following the client's point on a consistent hash ring, in order, passing over any with
+    // more than the load factor times the average active jobs, so a client keeps landing on
+    // the same workers while they have room. Workers repeat if there are fewer than count.
+    // Without a client_id or a load factor, the default, they are picked by the strategy,
+    // each from the workers not picked yet until all have been.
+    // Returns false if there are no workers.
+    bool GetWorkersForClient(const std::string& client_id, int count, std::vector<WorkerConnection*>* workers);
+    
+    // Least loaded healthy worker other than excluded, to take over or duplicate a request
+    // that failed or is slow on it; nullptr if there is no other
+    WorkerConnection* GetAlternateWorker(WorkerConnection* excluded);
     
     // Strategy management
     void SetStrategy(LoadBalancingStrategy strategy);
     LoadBalancingStrategy GetStrategy() const { return strategy_; }
     
-    // Statistics
-    std::vector<WorkerConnection*> GetAllWorkers();
+    // Bound on a worker's share of the load, as a multiple of the average, before clients
+    // hashed to it spill to the next worker on the ring; 0, the default, turns client
+    // affinity off
+    void SetAffinityLoadFactor(double factor) { affinity_load_factor_ = factor; }
+    
+    // Statistics; the workers routed to, as of the pool's latest snapshot
+    std::shared_ptr<const WorkerSnapshot> GetAllWorkers();
     int GetAvailableWorkerCount() const;
     
+    // Of two distinct workers drawn at random, the one with the lower expected wait,
+    // (active jobs + 1) x peak-EWMA latency. Constant time in the number of workers.
+    static WorkerConnection* PickPowerOfTwoChoices(const std::vector<WorkerConnection*>& workers);
+    
 private:
-    WorkerConnection* SelectRoundRobin();
-    WorkerConnection* SelectLeastLoaded();
-    WorkerConnection* SelectRandom();
-    WorkerConnection* SelectWeightedRoundRobin();
+    // Worker picked from workers, the healthy ones of a snapshot, by the strategy
+    WorkerConnection* SelectWorker(const std::vector<WorkerConnection*>& workers);
+    
+    WorkerConnection* SelectRoundRobin(const std::vector<WorkerConnection*>& workers);
+    WorkerConnection* SelectLeastLoaded(const std::vector<WorkerConnection*>& workers);
+    WorkerConnection* SelectRandom(const std::vector<WorkerConnection*>& workers);
+    WorkerConnection* SelectWeightedRoundRobin(const std::vector<WorkerConnection*>& workers);
     
     double CalculateWorkerWeight(WorkerConnection* worker) const;
+    
+    // Ring for snapshot, built by the first thread to need it and then shared. Each thread
+    // keeps the last one it used, so routing takes no lock until the workers change.
+    std::shared_ptr<const HashRing> GetRing(const std::shared_ptr<const WorkerSnapshot>& snapshot);
+    
+    // Places RING_VIRTUAL_NODES points per worker, hashed from its endpoint so a worker
+    // joining or leaving moves only the clients between its points and the ones before them
+    static std::shared_ptr<const HashRing> BuildRing(std::shared_ptr<const WorkerSnapshot> snapshot);
 };
 
 } // namespace RaycastMaster
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "worker_service.pb.h"
+#include "master_service.pb.h"
+
+namespace RaycastMaster {
+
+// A map clients uploaded, kept as the upload message workers need, ready to resend.
+// The cells are held in the most compact encoding that keeps them, until the first delta
+// expands them so later deltas can edit them in place. Recent deltas are kept too, so a
+// worker a few versions behind can be caught up without resending the whole map.
+//
+// Deltas edit a stored map in place, so everything a delta changes is read through the
+// methods below, which take the map's lock.
+struct StoredMap {
+    std::string map_id; // Content hash of version 1, naming the map through its deltas
+    int width = 0;
+    int height = 0;
+    
+    uint64_t GetVersion() const { return version.load(); }
+    
+    // Copies the upload for the current version
+    void CopyUpload(RaycastWorker::UploadMapRequest* out) const;
+    
+    // Fills delta with the changes from from_version to the current version, merged into one.
+    // Returns false if the history does not reach back that far.
+    bool BuildCatchUp(uint64_t from_version, RaycastWorker::MapDeltaRequest* delta) const;
+    
+private:
+    friend class MapStore;
+    
+    std::atomic<uint64_t> version{1};
+    mutable std::mutex mutex;
+    uint64_t content_hash = 0; // Of the current version's cells
+    RaycastWorker::UploadMapRequest upload; // Cells of the current version
+    std::vector<RaycastWorker::MapDeltaRequest> history; // Consecutive deltas ending at version
+    size_t stored_bytes = 0; // As counted by the store; guarded by its mutex
+    
+    size_t GetMemoryBytes() const; // Caller holds mutex
+};
+
+enum class MapPutResult {
+    STORED,
+    MALFORMED,
+    ID_MISMATCH
+};
+
+enum class MapDeltaResult {
+    APPLIED,
+    NOT_FOUND,
+    STALE_VERSION,
+    OUT_OF_BOUNDS
+};
+
+// Maps keyed by the content hash of their first version, evicting the least recently used once they exceed a byte
+// budget. Workers cache maps the same way, so the master re-uploads a map whenever a
+// worker reports it missing.
+class MapStore {
+private:
+    using Entry = std::shared_ptr<StoredMap>;
+    
+    static constexpr size_t MAX_DELTA_HISTORY = 32;
+    
+    size_t capacity_bytes_;
+    size_t used_bytes_ = 0;
+    std::list<Entry> lru_; // Most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    std::mutex mutex_; // Taken after a map's own lock, never before
+    
+public:
+    explicit MapStore(size_t capacity_bytes);
+    ~MapStore() = default;
+    
+    // Returns nullptr if the map is not stored
+    std::shared_ptr<const StoredMap> Get(const std::string& map_id);
+    
+    // Stores the first width * height cells under their content hash, unless already stored.
+    // A map stored under that hash whose deltas changed its cells is set back to them, as its
+    // next version. A non-empty map_id must be the id of the cells, or nothing is stored.
+    // map receives the stored map.
+    MapPutResult Put(const int32_t* cells, int width, int height, const std::string& map_id,
+                     std::shared_ptr<const StoredMap>* map);
+    
+    // Same, for cells a client sent compactly encoded; the bytes are kept as sent. Cells that
+    // are malformed or shorter than the map are not stored.
+    MapPutResult PutEncoded(const std::string& map_cells, RaycastWorker::MapEncoding encoding, bool compressed,
+                            int width, int height, const std::string& map_id,
+                            std::shared_ptr<const StoredMap>* map);
+    
+    // Applies a delta against base_version in place, taking the map to its next version.
+    // current_version receives the stored version afterwards, or the mismatching one.
+    MapDeltaResult ApplyDelta(const MapDeltaRequest& request, uint64_t* current_version);
+    
+    size_t GetUsedBytes();
+    int GetMapCount();
+    
+private:
+    // The stored map holding exactly the cells hashed to content_hash, or nullptr
+    Entry FindContent(uint64_t content_hash);
+    // Stores cells (an upload with only its dimensions and cells set) as a new map, or as the
+    // next version of the map already under their hash
+    Entry PutUpload(uint64_t content_hash, RaycastWorker::UploadMapRequest cells);
+    Entry Find(const std::string& map_id);
+    void Store(Entry map); // Caller holds mutex_
+    void Recount(StoredMap* map, size_t bytes); // Caller holds mutex_ and the map's lock
+    void Evict(); // Caller holds mutex_
+};
+
+} // namespace RaycastMaster
@@ -10,15 +10,31 @@
 #include "master_service.grpc.pb.h"
 #include "worker_pool.h"
 #include "load_balancer.h"
+#include "map_store.h"
+#include "frame_scatter.h"
 
 namespace RaycastMaster {
 
 class MasterServiceImpl final : public MasterService::Service {
 private:
+    static constexpr double ALLOCATION_AVERAGE_WEIGHT = 0.05; // Per request, for the moving average
+    static constexpr double MAX_HEDGE_TOKENS = 10.0; // Hedges the budget can bank for a burst
+    static constexpr double MAX_RETRY_TOKENS = 10.0; // Retries the budget can bank for a burst
+    
     std::unique_ptr<WorkerPool> worker_pool_;
     std::unique_ptr<LoadBalancer> load_balancer_;
+    std::unique_ptr<MapStore> map_store_;
+    int scatter_workers_;     // Ranges per unary request; 0 means one per healthy worker
+    int scatter_min_columns_; // Narrowest range worth sending to a worker of its own
+    int cost_bucket_columns_; // Step histogram bucket width for session frames; 0 splits by width
+    std::unique_ptr<RequestBudget> hedge_budget_;
+    HedgePolicy hedge_policy_;
+    std::unique_ptr<RequestBudget> retry_budget_;
+    int max_retries_; // Other workers a failed range may be moved to
     std::atomic<int> total_requests_processed_{0};
     std::atomic<double> total_response_time_ms_{0.0};
+    std::atomic<int64_t> last_request_allocations_{0};
+    std::atomic<double> allocations_per_request_{0.0};
     
 public:
     MasterServiceImpl();
@@ -33,14 +49,54 @@ public:
                                 const StatusRequest* request,
                                 MasterStatus* response) override;
     
+    grpc::Status UploadMap(grpc::ServerContext* context,
+                          const UploadMapRequest* request,
+                          UploadMapResponse* response) override;
+    
+    grpc::Status ApplyMapDelta(grpc::ServerContext* context,
+                              const MapDeltaRequest* request,
+                              MapDeltaResponse* response) override;
+    
+    grpc::Status RaycastSession(grpc::ServerContext* context,
+                               grpc::ServerReaderWriter<RaycastChunk, RaycastSessionRequest>* stream) override;
+                               
 private:
-    void ConvertRequest(const RaycastRequest* master_request, 
+    // Sends a stored map by id only, expecting the worker to have it cached; inline maps
+    // are passed through
+    void ConvertRequest(const RaycastRequest* master_request, const StoredMap* map,
                        RaycastWorker::RenderRequest* worker_request);
     
-    void ConvertResponse(const RaycastWorker::RenderResponse* worker_response,
+    // Brings a worker that answered NOT_FOUND or FAILED_PRECONDITION up to the map's
+    // version, by delta when the history allows and by full upload otherwise
+    grpc::Status SyncWorkerMap(WorkerConnection* worker, const StoredMap& map,
+                               const grpc::Status& worker_status);
+    
+    // Number of column ranges to split start..end into, given the ranges wanted (0 for one
+    // per healthy worker)
+    int GetScatterCount(int requested, int start_column, int end_column);
+    
+    // Picks a worker for each of count ranges, the same ones for a client while they have
+    // room, and sizes the ranges by the workers' measured throughput, and by the step counts
+    // of an earlier frame when costs are given. Returns false if there are no workers.
+    bool PlanScatter(const std::string& client_id, int count, int start_column, int end_column,
+                     std::vector<ColumnRange>* ranges, std::vector<WorkerConnection*>* workers,
+                     const ColumnCosts* costs = nullptr);
+    
+    // Next finished part of the scatter. Parts whose worker lacked the map are synced and
+    // sent again rather than returned, and parts whose worker failed are moved to another
+    // while the retry budget and their deadline allow. Returns nullptr once every part is back.
+    FramePart* NextPart(FrameScatter& scatter, const StoredMap* map);
+    
+    // Returns results in the encoding the client asked for, whichever the worker sent
+    void ConvertResponse(const RaycastWorker::RenderResponse* worker_response, ResultEncoding result_encoding,
+                        RaycastResponse* master_response);
+    
+    // Joins the responses for consecutive column ranges into one, in column order
+    void GatherResponses(const FrameScatter& scatter, ResultEncoding result_encoding,
                         RaycastResponse* master_response);
     
-    void UpdateStats(int64_t response_time_ms);
+    // allocations is the heap allocation count of the request on its handling thread
+    void UpdateStats(int64_t response_time_ms, int64_t allocations);
 };
 
 class MasterServer {
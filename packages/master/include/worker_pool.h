@@ -1,11 +1,16 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
 #include <vector>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <chrono>
 #include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <thread>
 
 #include <grpcpp/grpcpp.h>
 #include "worker_service.pb.h"
@@ -22,18 +27,39 @@ struct InternalWorkerInfo {
     int total_jobs_processed;
     double average_processing_time_ms;
     int64_t last_heartbeat;
+    double columns_per_ms;   // 0 until the worker has rendered something
+    double partition_weight; // Share of a split frame the worker would get now
+    int64_t retries;         // Renders retried on this worker after failing on another
+    int64_t failovers;       // Renders that failed on this worker and were retried on another
 };
 
 class WorkerConnection {
 private:
+    static constexpr double THROUGHPUT_AVERAGE_WEIGHT = 0.2; // Per render, for the moving average
+    static constexpr size_t LATENCY_SAMPLES = 64;     // Recent round trips kept for percentiles
+    static constexpr size_t MIN_LATENCY_SAMPLES = 16; // Fewer give no percentile
+    static constexpr double PEAK_LATENCY_DECAY_SECONDS = 2.0; // Time constant of the peak-EWMA latency
+    
     std::string endpoint_;
     std::unique_ptr<RaycastWorker::WorkerService::Stub> stub_;
     std::atomic<bool> is_healthy_{true};
     std::atomic<int> active_jobs_{0};
     std::atomic<int> total_jobs_processed_{0};
     std::atomic<double> total_processing_time_ms_{0.0};
+    std::atomic<double> columns_per_ms_{0.0};
+    std::atomic<int64_t> retries_{0};
+    std::atomic<int64_t> failovers_{0};
     std::chrono::steady_clock::time_point last_health_check_;
     std::mutex health_check_mutex_;
+    std::array<double, LATENCY_SAMPLES> latency_ms_{}; // Ring of round trips, in ms
+    size_t latency_count_ = 0;
+    std::mutex latency_mutex_;
+    std::atomic<double> peak_latency_ms_{0.0};
+    std::atomic<int64_t> peak_latency_at_ns_{0}; // steady_clock time of the last sample
+    std::function<void()> on_health_change_; // Called when is_healthy_ flips
+    std::atomic<int64_t>* pool_active_jobs_ = nullptr; // Pool's total, moved with active_jobs_
+    
+    void SetHealthy(bool healthy);
     
 public:
     explicit WorkerConnection(const std::string& endpoint);
@@ -45,47 +71,144 @@ public:
     bool IsHealthy();
     void MarkUnhealthy();
     
+    // Health as of the last check or failure, without checking again
+    bool WasHealthy() const { return is_healthy_.load(); }
+    
     // Health checking
     bool PerformHealthCheck();
     void UpdateLastHealthCheck();
     
+    // Calls handler on each change of health, on the thread that noticed it; set before the
+    // connection is shared
+    void SetHealthChangeHandler(std::function<void()> handler) { on_health_change_ = std::move(handler); }
+    
+    // Adds the active jobs to total as they change, from now on; total must outlive the connection
+    void SetActiveJobsCounter(std::atomic<int64_t>* total) { pool_active_jobs_ = total; }
+    
     // Job management
     void IncrementActiveJobs();
     void DecrementActiveJobs();
     void UpdateJobStats(int64_t processing_time_ms);
     
+    // Folds a render's column count and the processing time the worker reported for it into
+    // the worker's throughput average
+    void UpdateThroughput(int columns, int64_t processing_time_ms);
+    
+    // Records the round trip of a render as the master saw it
+    void RecordLatency(std::chrono::steady_clock::duration latency);
+    
+    // The given percentile (0 to 100) of the recent round trips in ms, or 0 while there are
+    // too few to tell
+    double GetLatencyPercentile(double percentile);
+    
+    // Peak-EWMA round trip in ms: jumps to a sample slower than the average at once, and
+    // otherwise averages samples in with weight for the time since the last one, over time
+    // constant PEAK_LATENCY_DECAY_SECONDS. Time without samples counts as instant answers,
+    // so a worker left alone after a slow spell is tried again. 0 until the first sample.
+    double GetPeakLatencyMs() const;
+    
+    // Failover accounting, for a render moved from this worker to another and the reverse
+    void CountFailover() { failovers_++; }
+    void CountRetry() { retries_++; }
+    
     // Getters
     const std::string& GetEndpoint() const { return endpoint_; }
     int GetActiveJobs() const { return active_jobs_.load(); }
     int GetTotalJobsProcessed() const { return total_jobs_processed_.load(); }
     double GetAverageProcessingTimeMs() const;
+    double GetColumnsPerMs() const { return columns_per_ms_.load(); }
+    int64_t GetRetries() const { return retries_.load(); }
+    int64_t GetFailovers() const { return failovers_.load(); }
+    
+    // Time a request to a worker may take, from REQUEST_TIMEOUT_SECONDS
+    static std::chrono::seconds GetRequestTimeout();
     
     // gRPC calls
     grpc::Status ProcessRenderRequest(const RaycastWorker::RenderRequest* request,
                                      RaycastWorker::RenderResponse* response);
     
+    // Starts a render without waiting for it, to be abandoned at deadline; the caller reads
+    // the result with Finish on cq and reports it with FinishRenderRequest. Returns nullptr
+    // if the worker is not connected.
+    std::unique_ptr<grpc::ClientAsyncResponseReader<RaycastWorker::RenderResponse>>
+    StartRenderRequest(grpc::ClientContext* context, const RaycastWorker::RenderRequest& request,
+                       grpc::CompletionQueue* cq, std::chrono::system_clock::time_point deadline);
+    
+    void FinishRenderRequest(const grpc::Status& status, int64_t processing_time_ms);
+    
     grpc::Status GetWorkerStatus(const RaycastWorker::StatusRequest* request,
                                 RaycastWorker::WorkerStatus* response);
+    
+    grpc::Status UploadMap(const RaycastWorker::UploadMapRequest* request,
+                          RaycastWorker::UploadMapResponse* response);
+    
+    grpc::Status ApplyMapDelta(const RaycastWorker::MapDeltaRequest* request,
+                              RaycastWorker::MapDeltaResponse* response);
 };
 
+// Whether a render's status says the worker itself failed, as opposed to answering that
+// it lacks the map or being cancelled by the master
+bool IsWorkerFailure(const grpc::Status& status);
+
+// Share of a split frame each worker should get, in proportion to its measured columns per
+// millisecond, so all ranges finish together. Workers not measured yet count as the average
+// of those that are. The weights sum to 1.
+std::vector<double> GetPartitionWeights(const std::vector<WorkerConnection*>& workers);
+
+// The healthy workers of a pool as of one publication. A snapshot never changes once
+// published, and holding it keeps its workers alive after they leave the pool.
+struct WorkerSnapshot {
+    uint64_t version = 0; // Unique across pools; a newer snapshot has a higher one
+    std::vector<WorkerConnection*> workers;
+    std::vector<std::shared_ptr<WorkerConnection>> owners;
+};
+
+// Workers of the master. Health sweeps and discovery run on a thread of the pool's own, so
+// requests never wait on a health check or on resolving workers; they route from the
+// published snapshot.
 class WorkerPool {
 private:
-    std::vector<std::unique_ptr<WorkerConnection>> workers_;
-    std::mutex workers_mutex_;
+    // Health is swept at least this often, to notice workers recovering, and at once when a
+    // worker is marked unhealthy
+    static constexpr std::chrono::seconds HEALTH_SWEEP_INTERVAL{1};
+    
+    std::vector<std::shared_ptr<WorkerConnection>> workers_;
+    std::mutex workers_mutex_; // Never held across a health check or discovery
+    
+    // Request routing reads the snapshot without locks. It is replaced, under workers_mutex_,
+    // when workers are added or removed or a sweep finds their health changed.
+    std::shared_ptr<const WorkerSnapshot> snapshot_; // Only through std::atomic_load and std::atomic_store
+    std::atomic<uint64_t> snapshot_version_{0};
+    std::atomic<int64_t> active_jobs_{0}; // Kept by the workers as their jobs change
+    
     std::string worker_service_name_;
     std::string worker_namespace_;
-    std::chrono::steady_clock::time_point last_discovery_;
-    std::chrono::seconds discovery_interval_{30}; // 30 seconds
+    std::chrono::steady_clock::time_point last_discovery_; // Under workers_mutex_
+    std::chrono::seconds discovery_interval_{30};          // Under workers_mutex_
+    
+    // The maintenance thread sleeps until a sweep is due, a worker's health changes or the
+    // pool is destroyed
+    std::mutex maintenance_mutex_;
+    std::condition_variable maintenance_wake_;
+    uint64_t health_changes_ = 0; // Under maintenance_mutex_
+    bool stopping_ = false;       // Under maintenance_mutex_
+    std::thread maintainer_;      // Last, so it starts once the rest is constructed
     
 public:
     explicit WorkerPool(const std::string& service_name = "raycast-worker-service",
                        const std::string& namespace_name = "default");
-    ~WorkerPool() = default;
+    ~WorkerPool();
     
-    // Worker discovery and management
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+    
+    // Resolves the workers, connects to new ones and drops those gone, then sweeps health.
+    // The maintenance thread runs it every discovery interval.
     void DiscoverWorkers();
-    void RefreshWorkers();
-    std::vector<WorkerConnection*> GetHealthyWorkers();
+    
+    // Latest published snapshot of the healthy workers. Wait-free and allocation-free while
+    // the calling thread has already seen this version; the maintenance thread keeps it current.
+    std::shared_ptr<const WorkerSnapshot> GetSnapshot() const;
     std::vector<WorkerConnection*> GetAllWorkers();
     
     // Worker operations
@@ -96,6 +219,10 @@ public:
     // Statistics
     int GetTotalWorkers();
     int GetActiveWorkers();
+    
+    // Jobs in flight on the pool's workers, removed ones included until their jobs end. Kept
+    // as a running total, so constant time in the number of workers.
+    int64_t GetActiveJobs() const { return active_jobs_.load(); }
     std::vector<InternalWorkerInfo> GetWorkerInfo();
     
     // Configuration
@@ -105,7 +232,21 @@ public:
     
 private:
     std::vector<std::string> GetWorkerEndpoints();
-    bool ShouldRefreshWorkers() const;
+    bool DiscoveryDue() const; // Caller holds workers_mutex_
+    
+    // Connection to endpoint reporting its health changes and jobs to the pool. Connecting
+    // checks its health, so the caller must not hold workers_mutex_.
+    std::shared_ptr<WorkerConnection> Connect(const std::string& endpoint);
+    
+    // Sweeps and discovers until the pool is destroyed
+    void Maintain();
+    void NotifyHealthChange();
+    
+    // Checks the health of every worker, unlocked, then publishes the healthy ones
+    void SweepHealth();
+    
+    // Publishes a new snapshot if the healthy workers changed. The caller holds workers_mutex_.
+    void PublishSnapshot();
 };
 
 } // namespace RaycastMaster
@@ -0,0 +1,390 @@
+#include "frame_scatter.h"
+#include "StepHistogram.h"
+#include <algorithm>
+#include <cmath>
+
+namespace RaycastMaster {
+
+namespace {
+
+// Casting a ray costs about this many steps on top of its traversal
+constexpr double RAY_SETUP_STEPS = 2.0;
+
+} // namespace
+
+std::vector<ColumnRange> SplitColumnsByWeight(int start_column, int end_column, const std::vector<double>& weights) {
+    std::vector<ColumnRange> ranges;
+    int width = std::max(end_column - start_column, 0);
+    int count = static_cast<int>(weights.size());
+    double total = 0.0;
+    for (double weight : weights) {
+        total += weight;
+    }
+    
+    double share = 0.0;
+    int column = start_column;
+    for (int i = 0; i < count; ++i) {
+        share += weights[i];
+        int end = i + 1 == count ? end_column
+                                 : start_column + static_cast<int>(std::lround(width * (share / total)));
+        // Leave every later range a column while there are enough
+        int remaining = count - i - 1;
+        end = std::max(end, std::min(column + 1, end_column - remaining));
+        end = std::min(end, std::max(end_column - remaining, column));
+        ranges.push_back({column, end});
+        column = end;
+    }
+    return ranges;
+}
+
+void ColumnCosts::Reset(int bucket_columns, int start_column, int end_column) {
+    this->bucket_columns = bucket_columns;
+    this->start_column = start_column;
+    this->end_column = end_column;
+    bucket_steps.assign(bucket_columns > 0 ? stepBucketCount(start_column, end_column, bucket_columns) : 0, 0);
+}
+
+bool ColumnCosts::Add(const ColumnRange& columns, const RaycastWorker::RenderResponse& response) {
+    if (Empty() || columns.start_column < start_column || columns.end_column > end_column ||
+        columns.end_column <= columns.start_column) {
+        return false;
+    }
+    size_t first = static_cast<size_t>(stepBucketOf(columns.start_column, bucket_columns) -
+                                       stepBucketOf(start_column, bucket_columns));
+    return addStepBuckets(response.column_steps(), bucket_steps.data() + first,
+                          stepBucketCount(columns.start_column, columns.end_column, bucket_columns));
+}
+
+std::vector<ColumnRange> SplitColumnsByCost(int start_column, int end_column, const ColumnCosts& costs,
+                                            const std::vector<double>& weights) {
+    if (costs.Empty() || weights.size() < 2 || end_column <= start_column) {
+        return SplitColumnsByWeight(start_column, end_column, weights);
+    }
+    
+    // Each counted column is predicted at the average of its bucket, the rest at the average of all
+    uint64_t counted_steps = 0;
+    for (uint64_t steps : costs.bucket_steps) {
+        counted_steps += steps;
+    }
+    double average_steps = static_cast<double>(counted_steps) / (costs.end_column - costs.start_column);
+    int first_bucket = stepBucketOf(costs.start_column, costs.bucket_columns);
+    auto predicted_steps = [&](int column) {
+        if (column < costs.start_column || column >= costs.end_column) {
+            return average_steps + RAY_SETUP_STEPS;
+        }
+        int bucket = stepBucketOf(column, costs.bucket_columns);
+        int bucket_start = bucket * costs.bucket_columns;
+        int covered = std::min(bucket_start + costs.bucket_columns, costs.end_column) -
+                      std::max(bucket_start, costs.start_column);
+        return static_cast<double>(costs.bucket_steps[bucket - first_bucket]) / covered + RAY_SETUP_STEPS;
+    };
+    
+    double total_steps = 0.0;
+    for (int column = start_column; column < end_column; ++column) {
+        total_steps += predicted_steps(column);
+    }
+    double total_weight = 0.0;
+    for (double weight : weights) {
+        total_weight += weight;
+    }
+    
+    std::vector<ColumnRange> ranges;
+    int count = static_cast<int>(weights.size());
+    double share = 0.0;
+    double steps_before = 0.0; // Predicted steps of the columns before next_column
+    int next_column = start_column;
+    int column = start_column;
+    for (int i = 0; i < count; ++i) {
+        share += weights[i];
+        int end = end_column;
+        if (i + 1 < count) {
+            // Take columns while at least half of the next one falls within the share
+            double target = total_steps * (share / total_weight);
+            while (next_column < end_column && steps_before + predicted_steps(next_column) / 2 < target) {
+                steps_before += predicted_steps(next_column++);
+            }
+            end = next_column;
+        }
+        // Leave every later range a column while there are enough
+        int remaining = count - i - 1;
+        end = std::max(end, std::min(column + 1, end_column - remaining));
+        end = std::min(end, std::max(end_column - remaining, column));
+        for (; next_column < end; ++next_column) {
+            steps_before += predicted_steps(next_column);
+        }
+        for (; next_column > end; --next_column) {
+            steps_before -= predicted_steps(next_column - 1);
+        }
+        ranges.push_back({column, end});
+        column = end;
+    }
+    return ranges;
+}
+
+void RequestBudget::Earn() {
+    double tokens = tokens_.load();
+    while (tokens < max_tokens_ && !tokens_.compare_exchange_weak(tokens, std::min(tokens + ratio_, max_tokens_))) {
+    }
+}
+
+bool RequestBudget::TrySpend() {
+    double tokens = tokens_.load();
+    while (tokens >= 1.0) {
+        if (tokens_.compare_exchange_weak(tokens, tokens - 1.0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+FrameScatter::FrameScatter() : poller_(&FrameScatter::Poll, this) {}
+
+FrameScatter::~FrameScatter() {
+    hedging_ = nullptr;
+    Reset();
+    cq_.Shutdown();
+    poller_.join();
+}
+
+void FrameScatter::Start(const RaycastWorker::RenderRequest& base, const std::vector<ColumnRange>& ranges,
+                         const std::vector<WorkerConnection*>& workers, std::chrono::system_clock::time_point deadline) {
+    DrainCalls();
+    while (parts_.size() < ranges.size()) {
+        parts_.push_back(std::make_unique<FramePart>());
+    }
+    part_count_ = ranges.size();
+    
+    for (size_t i = 0; i < part_count_; ++i) {
+        FramePart* part = parts_[i].get();
+        part->columns = ranges[i];
+        part->worker = workers[i];
+        part->attempts = 0;
+        part->retries = 0;
+        part->synced_worker = nullptr;
+        part->deadline = deadline;
+        part->request.CopyFrom(base);
+        part->request.set_start_column(ranges[i].start_column);
+        part->request.set_end_column(ranges[i].end_column);
+        Send(part);
+    }
+}
+
+void FrameScatter::Resend(FramePart* part, WorkerConnection* worker) {
+    part->worker = worker;
+    Send(part);
+}
+
+void FrameScatter::Send(FramePart* part) {
+    part->attempts++;
+    part->finished = false;
+    part->hedge_won = false;
+    part->hedge_at = std::chrono::steady_clock::time_point::max();
+    pending_++;
+    if (!StartCall(part, part->request)) {
+        failed_to_send_.push_back(part);
+        return;
+    }
+    
+    // Hedge once the call has taken longer than the worker usually does, if it has a record
+    if (hedging_ && hedging_->percentile > 0.0) {
+        hedging_->budget->Earn();
+        double hedge_after_ms = part->worker->GetLatencyPercentile(hedging_->percentile);
+        if (hedge_after_ms > 0.0) {
+            part->hedge_at = part->sent_at + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double, std::milli>(hedge_after_ms));
+        }
+    }
+}
+
+bool FrameScatter::StartCall(FramePart* call, const RaycastWorker::RenderRequest& request) {
+    call->response.Clear();
+    call->status = grpc::Status::OK;
+    call->elapsed_ms = 0;
+    call->context = std::make_unique<grpc::ClientContext>();
+    call->sent_at = std::chrono::steady_clock::now();
+    
+    call->reader = call->worker->StartRenderRequest(call->context.get(), request, &cq_, call->deadline);
+    if (!call->reader) {
+        call->status = grpc::Status(grpc::StatusCode::UNAVAILABLE, "Worker not connected");
+        return false;
+    }
+    call->in_flight = true;
+    calls_in_flight_++;
+    call->reader->Finish(&call->response, &call->status, call);
+    return true;
+}
+
+void FrameScatter::HedgeSlowParts(std::chrono::steady_clock::time_point now) {
+    for (size_t i = 0; i < part_count_; ++i) {
+        FramePart* part = parts_[i].get();
+        if (part->finished || !part->in_flight || part->hedge_at > now) {
+            continue;
+        }
+        // One hedge per send, and none while an earlier one is still being cancelled
+        part->hedge_at = std::chrono::steady_clock::time_point::max();
+        if (part->hedge && part->hedge->in_flight) {
+            continue;
+        }
+        WorkerConnection* worker = hedging_->load_balancer->GetAlternateWorker(part->worker);
+        if (!worker || !hedging_->budget->TrySpend()) {
+            continue;
+        }
+        if (!part->hedge) {
+            part->hedge = std::make_unique<FramePart>();
+            part->hedge->hedge_of = part;
+        }
+        part->hedge->worker = worker;
+        part->hedge->columns = part->columns;
+        part->hedge->deadline = part->deadline;
+        StartCall(part->hedge.get(), part->request);
+    }
+}
+
+std::chrono::steady_clock::time_point FrameScatter::NextHedgeTime() const {
+    auto next = std::chrono::steady_clock::time_point::max();
+    if (!hedging_) {
+        return next;
+    }
+    for (size_t i = 0; i < part_count_; ++i) {
+        const FramePart* part = parts_[i].get();
+        if (!part->finished && part->in_flight) {
+            next = std::min(next, part->hedge_at);
+        }
+    }
+    return next;
+}
+
+FramePart* FrameScatter::Next() {
+    while (pending_ > 0) {
+        if (!failed_to_send_.empty()) {
+            FramePart* part = failed_to_send_.back();
+            failed_to_send_.pop_back();
+            part->finished = true;
+            pending_--;
+            return part;
+        }
+        
+        FramePart* call = WaitForCall(NextHedgeTime());
+        if (!call) {
+            HedgeSlowParts(std::chrono::steady_clock::now());
+            continue;
+        }
+        
+        if (FramePart* part = Complete(call)) {
+            part->finished = true;
+            pending_--;
+            return part;
+        }
+    }
+    return nullptr;
+}
+
+void FrameScatter::Poll() {
+    void* tag;
+    bool ok;
+    while (cq_.Next(&tag, &ok)) {
+        auto* call = static_cast<FramePart*>(tag);
+        call->completed_at = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(completed_mutex_);
+            completed_.push_back(call);
+        }
+        completed_ready_.notify_one();
+    }
+}
+
+FramePart* FrameScatter::WaitForCall(std::chrono::steady_clock::time_point until) {
+    std::unique_lock<std::mutex> lock(completed_mutex_);
+    auto ready = [this] { return !completed_.empty(); };
+    if (until == std::chrono::steady_clock::time_point::max()) {
+        completed_ready_.wait(lock, ready);
+    } else if (!completed_ready_.wait_until(lock, until, ready)) {
+        return nullptr;
+    }
+    FramePart* call = completed_.front();
+    completed_.pop_front();
+    return call;
+}
+
+FramePart* FrameScatter::Complete(FramePart* call) {
+    call->in_flight = false;
+    calls_in_flight_--;
+    auto latency = call->completed_at - call->sent_at;
+    call->elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(latency).count();
+    call->worker->FinishRenderRequest(call->status, call->elapsed_ms);
+    if (call->status.ok()) {
+        call->worker->UpdateThroughput(call->columns.end_column - call->columns.start_column,
+                                       call->response.processing_time_ms());
+    }
+    
+    FramePart* part = call->hedge_of ? call->hedge_of : call;
+    FramePart* other = call == part ? part->hedge.get() : part;
+    bool other_in_flight = other && other->in_flight;
+    if (part->finished) {
+        // A loser; it took at least this long, which the worker's latency record should know
+        call->worker->RecordLatency(latency);
+        if (call == part && part->hedge_won) {
+            // The first call can no longer write into the part, so the hedge's answer moves in
+            std::swap(part->worker, part->hedge->worker);
+            part->response.Swap(&part->hedge->response);
+            std::swap(part->status, part->hedge->status);
+            part->elapsed_ms = part->hedge->elapsed_ms;
+            part->hedge_won = false;
+            return part;
+        }
+        return nullptr;
+    }
+    if (call->status.ok()) {
+        call->worker->RecordLatency(latency);
+    } else if (other_in_flight) {
+        // The other call may yet succeed
+        return nullptr;
+    }
+    
+    if (other_in_flight) {
+        other->context->TryCancel();
+    }
+    if (call != part && part->in_flight) {
+        part->finished = true;
+        part->hedge_won = true;
+        return nullptr;
+    }
+    if (call != part) {
+        std::swap(part->worker, call->worker);
+        part->response.Swap(&call->response);
+        std::swap(part->status, call->status);
+        part->elapsed_ms = call->elapsed_ms;
+    }
+    return part;
+}
+
+void FrameScatter::DrainCalls() {
+    while (calls_in_flight_ > 0) {
+        Complete(WaitForCall(std::chrono::steady_clock::time_point::max()));
+    }
+}
+
+void FrameScatter::Reset() {
+    // Nothing waited on here should be hedged
+    const HedgePolicy* hedging = hedging_;
+    hedging_ = nullptr;
+    CancelPending();
+    while (Next() != nullptr) {
+    }
+    DrainCalls();
+    hedging_ = hedging;
+}
+
+void FrameScatter::CancelPending() {
+    for (size_t i = 0; i < part_count_; ++i) {
+        FramePart* part = parts_[i].get();
+        if (part->in_flight) {
+            part->context->TryCancel();
+        }
+        if (part->hedge && part->hedge->in_flight) {
+            part->hedge->context->TryCancel();
+        }
+    }
+}
+
+} // namespace RaycastMaster
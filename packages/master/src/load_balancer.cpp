@@ -1,73 +1,179 @@
 #include "load_balancer.h"
 #include <algorithm>
+#include <cmath>
 #include <numeric>
 
 namespace RaycastMaster {
 
+namespace {
+
+// Keeps workers with no latency record yet, or one decayed to nothing, ordered by their jobs
+constexpr double LATENCY_FLOOR_MS = 0.001;
+
+double ExpectedWaitMs(WorkerConnection* worker) {
+    return (worker->GetActiveJobs() + 1) * (worker->GetPeakLatencyMs() + LATENCY_FLOOR_MS);
+}
+
+// 64-bit FNV-1a, finished with the splitmix64 mixer so keys differing in their last
+// characters, as virtual node names do, still land far apart on the ring
+uint64_t RingHash(const std::string& key) {
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : key) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 1099511628211ull;
+    }
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9ull;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebull;
+    hash ^= hash >> 31;
+    return hash;
+}
+
+// Per thread, so random picks take no lock
+std::minstd_rand& ThreadRandom() {
+    thread_local std::minstd_rand generator(std::random_device{}());
+    return generator;
+}
+
+} // namespace
+
+LoadBalancingStrategy ParseLoadBalancingStrategy(const std::string& name, LoadBalancingStrategy fallback) {
+    if (name == "round_robin") return LoadBalancingStrategy::ROUND_ROBIN;
+    if (name == "least_loaded") return LoadBalancingStrategy::LEAST_LOADED;
+    if (name == "random") return LoadBalancingStrategy::RANDOM;
+    if (name == "weighted_round_robin") return LoadBalancingStrategy::WEIGHTED_ROUND_ROBIN;
+    if (name == "p2c") return LoadBalancingStrategy::POWER_OF_TWO_CHOICES;
+    return fallback;
+}
+
 LoadBalancer::LoadBalancer(WorkerPool* worker_pool, LoadBalancingStrategy strategy)
     : worker_pool_(worker_pool),
-      strategy_(strategy),
-      random_generator_(std::random_device{}()),
-      random_distribution_(0, 0) { // Will be updated in GetNextWorker
+      strategy_(strategy) {
 }
 
 WorkerConnection* LoadBalancer::GetNextWorker() {
-    auto workers = worker_pool_->GetHealthyWorkers();
+    auto snapshot = worker_pool_->GetSnapshot();
+    return SelectWorker(snapshot->workers);
+}
+
+WorkerConnection* LoadBalancer::SelectWorker(const std::vector<WorkerConnection*>& workers) {
     if (workers.empty()) {
         return nullptr;
     }
     
-    // Update random distribution range
-    random_distribution_ = std::uniform_int_distribution<size_t>(0, workers.size() - 1);
-    
     switch (strategy_) {
         case LoadBalancingStrategy::ROUND_ROBIN:
-            return SelectRoundRobin();
+            return SelectRoundRobin(workers);
         case LoadBalancingStrategy::LEAST_LOADED:
-            return SelectLeastLoaded();
+            return SelectLeastLoaded(workers);
         case LoadBalancingStrategy::RANDOM:
-            return SelectRandom();
+            return SelectRandom(workers);
         case LoadBalancingStrategy::WEIGHTED_ROUND_ROBIN:
-            return SelectWeightedRoundRobin();
+            return SelectWeightedRoundRobin(workers);
+        case LoadBalancingStrategy::POWER_OF_TWO_CHOICES:
+            return PickPowerOfTwoChoices(workers);
         default:
-            return SelectRoundRobin();
+            return SelectRoundRobin(workers);
+    }
+}
+
+WorkerConnection* LoadBalancer::GetWorkerForRequest(const std::string& client_id) {
+    thread_local std::vector<WorkerConnection*> workers;
+    return GetWorkersForClient(client_id, 1, &workers) ? workers[0] : nullptr;
+}
+
+bool LoadBalancer::GetWorkersForClient(const std::string& client_id, int count,
+                                       std::vector<WorkerConnection*>* workers) {
+    workers->clear();
+    auto snapshot = worker_pool_->GetSnapshot();
+    const auto& healthy = snapshot->workers;
+    if (healthy.empty()) {
+        return false;
+    }
+    
+    // Each worker is picked by the strategy from those not picked yet, so a split frame
+    // lands on distinct workers while there are enough
+    if (client_id.empty() || affinity_load_factor_ <= 0.0) {
+        if (count == 1) {
+            workers->push_back(SelectWorker(healthy));
+            return true;
+        }
+        thread_local std::vector<WorkerConnection*> remaining;
+        remaining.clear();
+        for (int i = 0; i < count; ++i) {
+            if (remaining.empty()) {
+                remaining.assign(healthy.begin(), healthy.end());
+            }
+            WorkerConnection* worker = SelectWorker(remaining);
+            workers->push_back(worker);
+            std::swap(*std::find(remaining.begin(), remaining.end(), worker), remaining.back());
+            remaining.pop_back();
+        }
+        return true;
+    }
+    
+    // Room for the average load, jobs about to be added included, times the load factor
+    int64_t total_jobs = worker_pool_->GetActiveJobs() + count;
+    double capacity = std::ceil(affinity_load_factor_ * total_jobs / healthy.size());
+    
+    // Walk the ring from the client's point, taking each worker with room the first time it
+    // comes up, until count are taken or the walk is back where it began
+    auto ring = GetRing(snapshot);
+    const auto& nodes = ring->nodes;
+    uint64_t point = RingHash(client_id);
+    auto start = std::lower_bound(nodes.begin(), nodes.end(), point,
+                                  [](const RingNode& node, uint64_t hash) { return node.hash < hash; });
+    size_t first = static_cast<size_t>(start - nodes.begin());
+    size_t wanted = std::min(static_cast<size_t>(count), healthy.size());
+    for (size_t i = 0; i < nodes.size() && workers->size() < wanted; ++i) {
+        WorkerConnection* worker = nodes[(first + i) % nodes.size()].worker;
+        if (worker->GetActiveJobs() < capacity &&
+            std::find(workers->begin(), workers->end(), worker) == workers->end()) {
+            workers->push_back(worker);
+        }
+    }
+    
+    // Every worker is over the bound, only possible with a load factor under 1
+    if (workers->empty()) {
+        workers->push_back(nodes[first % nodes.size()].worker);
+    }
+    size_t found = workers->size();
+    for (size_t i = found; i < static_cast<size_t>(count); ++i) {
+        workers->push_back((*workers)[i % found]);
     }
+    return true;
 }
 
-WorkerConnection* LoadBalancer::GetWorkerForRequest(const std::string& request_id) {
-    // For now, just use the same logic as GetNextWorker
-    // In the future, you could implement request affinity based on request_id
-    return GetNextWorker();
+WorkerConnection* LoadBalancer::GetAlternateWorker(WorkerConnection* excluded) {
+    auto snapshot = worker_pool_->GetSnapshot();
+    WorkerConnection* best = nullptr;
+    for (WorkerConnection* worker : snapshot->workers) {
+        if (worker != excluded && (!best || worker->GetActiveJobs() < best->GetActiveJobs())) {
+            best = worker;
+        }
+    }
+    return best;
 }
 
 void LoadBalancer::SetStrategy(LoadBalancingStrategy strategy) {
     strategy_ = strategy;
 }
 
-std::vector<WorkerConnection*> LoadBalancer::GetAllWorkers() {
-    return worker_pool_->GetHealthyWorkers();
+std::shared_ptr<const WorkerSnapshot> LoadBalancer::GetAllWorkers() {
+    return worker_pool_->GetSnapshot();
 }
 
 int LoadBalancer::GetAvailableWorkerCount() const {
     return worker_pool_->GetActiveWorkers();
 }
 
-WorkerConnection* LoadBalancer::SelectRoundRobin() {
-    auto workers = worker_pool_->GetHealthyWorkers();
-    if (workers.empty()) {
-        return nullptr;
-    }
-    
+WorkerConnection* LoadBalancer::SelectRoundRobin(const std::vector<WorkerConnection*>& workers) {
     size_t index = round_robin_index_.fetch_add(1) % workers.size();
     return workers[index];
 }
 
-WorkerConnection* LoadBalancer::SelectLeastLoaded() {
-    auto workers = worker_pool_->GetHealthyWorkers();
-    if (workers.empty()) {
-        return nullptr;
-    }
-    
+WorkerConnection* LoadBalancer::SelectLeastLoaded(const std::vector<WorkerConnection*>& workers) {
     // Find worker with least active jobs
     auto min_worker = std::min_element(workers.begin(), workers.end(),
         [](WorkerConnection* a, WorkerConnection* b) {
@@ -77,35 +183,71 @@ WorkerConnection* LoadBalancer::SelectLeastLoaded() {
     return *min_worker;
 }
 
-WorkerConnection* LoadBalancer::SelectRandom() {
-    auto workers = worker_pool_->GetHealthyWorkers();
-    if (workers.empty()) {
-        return nullptr;
+WorkerConnection* LoadBalancer::SelectRandom(const std::vector<WorkerConnection*>& workers) {
+    return workers[ThreadRandom()() % workers.size()];
+}
+
+WorkerConnection* LoadBalancer::SelectWeightedRoundRobin(const std::vector<WorkerConnection*>& workers) {
+    // Find worker with highest weight
+    WorkerConnection* best = nullptr;
+    double best_weight = 0.0;
+    for (auto* worker : workers) {
+        double weight = CalculateWorkerWeight(worker);
+        if (!best || weight > best_weight) {
+            best = worker;
+            best_weight = weight;
+        }
     }
-    
-    size_t index = random_distribution_(random_generator_);
-    return workers[index];
+    return best;
 }
 
-WorkerConnection* LoadBalancer::SelectWeightedRoundRobin() {
-    auto workers = worker_pool_->GetHealthyWorkers();
+WorkerConnection* LoadBalancer::PickPowerOfTwoChoices(const std::vector<WorkerConnection*>& workers) {
     if (workers.empty()) {
         return nullptr;
     }
-    
-    // Calculate weights for all workers
-    std::vector<double> weights;
-    weights.reserve(workers.size());
-    
-    for (auto* worker : workers) {
-        weights.push_back(CalculateWorkerWeight(worker));
+    if (workers.size() == 1) {
+        return workers[0];
     }
     
-    // Find worker with highest weight
-    auto max_weight_it = std::max_element(weights.begin(), weights.end());
-    size_t max_weight_index = std::distance(weights.begin(), max_weight_it);
+    std::minstd_rand& generator = ThreadRandom();
+    size_t first = generator() % workers.size();
+    size_t second = generator() % (workers.size() - 1);
+    if (second >= first) {
+        second++;
+    }
     
-    return workers[max_weight_index];
+    WorkerConnection* a = workers[first];
+    WorkerConnection* b = workers[second];
+    return ExpectedWaitMs(a) <= ExpectedWaitMs(b) ? a : b;
+}
+
+std::shared_ptr<const LoadBalancer::HashRing> LoadBalancer::GetRing(
+    const std::shared_ptr<const WorkerSnapshot>& snapshot) {
+    thread_local std::shared_ptr<const HashRing> seen;
+    if (!seen || seen->snapshot->version != snapshot->version) {
+        // A thread still on an older snapshot uses the newer ring rather than going back
+        std::lock_guard<std::mutex> lock(ring_mutex_);
+        if (!ring_ || ring_->snapshot->version < snapshot->version) {
+            ring_ = BuildRing(snapshot);
+        }
+        seen = ring_;
+    }
+    return seen;
+}
+
+std::shared_ptr<const LoadBalancer::HashRing> LoadBalancer::BuildRing(
+    std::shared_ptr<const WorkerSnapshot> snapshot) {
+    auto ring = std::make_shared<HashRing>();
+    ring->nodes.reserve(snapshot->workers.size() * RING_VIRTUAL_NODES);
+    for (WorkerConnection* worker : snapshot->workers) {
+        for (int i = 0; i < RING_VIRTUAL_NODES; ++i) {
+            ring->nodes.push_back({RingHash(worker->GetEndpoint() + "#" + std::to_string(i)), worker});
+        }
+    }
+    std::sort(ring->nodes.begin(), ring->nodes.end(),
+              [](const RingNode& a, const RingNode& b) { return a.hash < b.hash; });
+    ring->snapshot = std::move(snapshot);
+    return ring;
 }
 
 double LoadBalancer::CalculateWorkerWeight(WorkerConnection* worker) const {
@@ -120,7 +262,7 @@ double LoadBalancer::CalculateWorkerWeight(WorkerConnection* worker) const {
     
     double active_jobs_weight = 1.0 / (1.0 + worker->GetActiveJobs());
     double processing_speed_weight = 1.0 / (1.0 + worker->GetAverageProcessingTimeMs() / 1000.0);
-    double health_weight = worker->IsHealthy() ? 1.0 : 0.0;
+    double health_weight = 1.0; // Only healthy workers are routed to
     
     // Combine weights (you can adjust these coefficients)
     return active_jobs_weight * 0.5 + processing_speed_weight * 0.3 + health_weight * 0.2;
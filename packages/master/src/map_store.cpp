@@ -0,0 +1,361 @@
+#include "map_store.h"
+#include "MapHash.h"
+#include "MapCodec.h"
+
+namespace RaycastMaster {
+
+namespace {
+    // Sets the upload's cells in the smallest encoding that keeps them, run-length
+    // compressed when compress is set and that is smaller still
+    void EncodeCells(const int32_t* cells, int width, int height, bool compress,
+                     RaycastWorker::UploadMapRequest* upload) {
+        size_t count = static_cast<size_t>(width) * height;
+        MapCellEncoding encoding = smallestMapEncoding(cells, count);
+        upload->clear_map();
+        upload->clear_map_cells();
+        upload->set_map_encoding(static_cast<RaycastWorker::MapEncoding>(encoding));
+        upload->set_map_cells_compressed(false);
+        if (encoding == MapCellEncoding::NONE) {
+            upload->mutable_map()->Add(cells, cells + count);
+            return;
+        }
+        
+        std::string encoded = encodeMapCells(cells, width, height, encoding);
+        std::string compressed = compress ? compressMapRuns(reinterpret_cast<const uint8_t*>(encoded.data()),
+                                                            encoded.size())
+                                          : std::string();
+        if (compress && compressed.size() < encoded.size()) {
+            upload->set_map_cells(std::move(compressed));
+            upload->set_map_cells_compressed(true);
+        } else {
+            upload->set_map_cells(std::move(encoded));
+        }
+    }
+    
+    // Stored uploads were checked when put, so decoding them cannot fail
+    std::vector<int32_t> DecodeCells(const RaycastWorker::UploadMapRequest& upload) {
+        std::vector<int32_t> cells;
+        if (upload.map_encoding() != RaycastWorker::MAP_ENCODING_NONE) {
+            decodeMapCells(upload.map_cells(), static_cast<MapCellEncoding>(upload.map_encoding()),
+                           upload.map_cells_compressed(), upload.map_width(), upload.map_height(), cells);
+        } else {
+            cells.assign(upload.map().begin(), upload.map().end());
+        }
+        return cells;
+    }
+    
+    // Expands run-length compressed cells so they can be edited in place
+    void ExpandCells(RaycastWorker::UploadMapRequest* upload) {
+        if (!upload->map_cells_compressed()) {
+            return;
+        }
+        std::string expanded;
+        expandMapRuns(upload->map_cells(),
+                      mapCellBytes(static_cast<MapCellEncoding>(upload->map_encoding()), upload->map_width(),
+                                   upload->map_height()),
+                      expanded);
+        upload->set_map_cells(std::move(expanded));
+        upload->set_map_cells_compressed(false);
+    }
+    
+    bool CellFits(RaycastWorker::MapEncoding encoding, int32_t value) {
+        switch (encoding) {
+            case RaycastWorker::MAP_ENCODING_UINT8:
+                return value >= 0 && value <= 255;
+            case RaycastWorker::MAP_ENCODING_BITSET:
+                return value == 0 || value == 1;
+            default:
+                return true;
+        }
+    }
+    
+    // Cell access on uncompressed uploads
+    int32_t GetCell(const RaycastWorker::UploadMapRequest& upload, int x, int y) {
+        size_t index = static_cast<size_t>(y) * upload.map_width() + x;
+        switch (upload.map_encoding()) {
+            case RaycastWorker::MAP_ENCODING_UINT8:
+                return static_cast<uint8_t>(upload.map_cells()[index]);
+            case RaycastWorker::MAP_ENCODING_BITSET:
+                return (upload.map_cells()[y * mapBitsetRowBytes(upload.map_width()) + (x >> 3)] >> (x & 7)) & 1;
+            default:
+                return upload.map(static_cast<int>(index));
+        }
+    }
+    
+    // The value must fit the upload's encoding
+    void SetCell(RaycastWorker::UploadMapRequest* upload, int x, int y, int32_t value) {
+        size_t index = static_cast<size_t>(y) * upload->map_width() + x;
+        switch (upload->map_encoding()) {
+            case RaycastWorker::MAP_ENCODING_UINT8:
+                (*upload->mutable_map_cells())[index] = static_cast<char>(value);
+                break;
+            case RaycastWorker::MAP_ENCODING_BITSET: {
+                char& bits = (*upload->mutable_map_cells())[y * mapBitsetRowBytes(upload->map_width()) + (x >> 3)];
+                bits = static_cast<char>((bits & ~(1 << (x & 7))) | (value << (x & 7)));
+                break;
+            }
+            default:
+                upload->set_map(static_cast<int>(index), value);
+                break;
+        }
+    }
+}
+
+size_t StoredMap::GetMemoryBytes() const {
+    return static_cast<size_t>(upload.map_size()) * sizeof(int32_t) + upload.map_cells().size();
+}
+
+void StoredMap::CopyUpload(RaycastWorker::UploadMapRequest* out) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    *out = upload;
+}
+
+MapStore::MapStore(size_t capacity_bytes)
+    : capacity_bytes_(capacity_bytes) {
+}
+
+MapStore::Entry MapStore::Find(const std::string& map_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    auto it = index_.find(map_id);
+    if (it == index_.end()) {
+        return nullptr;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return *it->second;
+}
+
+std::shared_ptr<const StoredMap> MapStore::Get(const std::string& map_id) {
+    return Find(map_id);
+}
+
+MapStore::Entry MapStore::FindContent(uint64_t content_hash) {
+    Entry map = Find(formatMapId(content_hash));
+    if (!map) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> map_lock(map->mutex);
+    return map->content_hash == content_hash ? map : nullptr;
+}
+
+MapPutResult MapStore::Put(const int32_t* cells, int width, int height, const std::string& map_id,
+                           std::shared_ptr<const StoredMap>* map) {
+    size_t count = static_cast<size_t>(width) * height;
+    uint64_t content_hash = computeMapHash(cells, count, width, height);
+    if (!map_id.empty() && map_id != formatMapId(content_hash)) {
+        return MapPutResult::ID_MISMATCH;
+    }
+    if ((*map = FindContent(content_hash))) {
+        return MapPutResult::STORED;
+    }
+    
+    RaycastWorker::UploadMapRequest upload;
+    upload.set_map_width(width);
+    upload.set_map_height(height);
+    EncodeCells(cells, width, height, true, &upload);
+    *map = PutUpload(content_hash, std::move(upload));
+    return MapPutResult::STORED;
+}
+
+MapPutResult MapStore::PutEncoded(const std::string& map_cells, RaycastWorker::MapEncoding encoding, bool compressed,
+                                  int width, int height, const std::string& map_id,
+                                  std::shared_ptr<const StoredMap>* map) {
+    // The id is the hash of the decoded cells, so it does not depend on the encoding
+    std::vector<int32_t> cells;
+    if (!decodeMapCells(map_cells, static_cast<MapCellEncoding>(encoding), compressed, width, height, cells)) {
+        return MapPutResult::MALFORMED;
+    }
+    uint64_t content_hash = computeMapHash(cells.data(), cells.size(), width, height);
+    if (!map_id.empty() && map_id != formatMapId(content_hash)) {
+        return MapPutResult::ID_MISMATCH;
+    }
+    if ((*map = FindContent(content_hash))) {
+        return MapPutResult::STORED;
+    }
+    
+    RaycastWorker::UploadMapRequest upload;
+    upload.set_map_width(width);
+    upload.set_map_height(height);
+    upload.set_map_cells(map_cells);
+    if (!compressed) {
+        upload.mutable_map_cells()->resize(mapCellBytes(static_cast<MapCellEncoding>(encoding), width, height));
+    }
+    upload.set_map_encoding(encoding);
+    upload.set_map_cells_compressed(compressed);
+    *map = PutUpload(content_hash, std::move(upload));
+    return MapPutResult::STORED;
+}
+
+MapStore::Entry MapStore::PutUpload(uint64_t content_hash, RaycastWorker::UploadMapRequest cells) {
+    std::string map_id = formatMapId(content_hash);
+    cells.set_map_id(map_id);
+    cells.set_content_id(map_id);
+    
+    Entry map = Find(map_id);
+    if (map) {
+        std::lock_guard<std::mutex> map_lock(map->mutex);
+        if (map->content_hash != content_hash) {
+            // Deltas have changed the cells since they were first put. The history cannot
+            // bridge this step, so workers behind it get the whole map again.
+            uint64_t version = map->version + 1;
+            map->upload = std::move(cells);
+            map->upload.set_map_version(version);
+            map->content_hash = content_hash;
+            map->history.clear();
+            map->version = version;
+            
+            std::lock_guard<std::mutex> lock(mutex_);
+            Recount(map.get(), map->GetMemoryBytes());
+        }
+        return map;
+    }
+    
+    map = std::make_shared<StoredMap>();
+    map->map_id = map_id;
+    map->width = cells.map_width();
+    map->height = cells.map_height();
+    map->content_hash = content_hash;
+    map->upload = std::move(cells);
+    map->upload.set_map_version(map->version);
+    map->stored_bytes = map->GetMemoryBytes();
+    
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(map_id);
+    if (it != index_.end()) {
+        // Another put of this map finished first
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return *it->second;
+    }
+    Store(map);
+    return map;
+}
+
+MapDeltaResult MapStore::ApplyDelta(const MapDeltaRequest& request, uint64_t* current_version) {
+    Entry map = Find(request.map_id());
+    if (!map) {
+        return MapDeltaResult::NOT_FOUND;
+    }
+    
+    // The map's lock serializes deltas, so each applies to the version it names
+    std::lock_guard<std::mutex> map_lock(map->mutex);
+    *current_version = map->version;
+    if (map->version != request.base_version()) {
+        return MapDeltaResult::STALE_VERSION;
+    }
+    
+    bool fits = true;
+    for (const auto& change : request.changes()) {
+        if (change.x() < 0 || change.x() >= map->width || change.y() < 0 || change.y() >= map->height) {
+            return MapDeltaResult::OUT_OF_BOUNDS;
+        }
+        fits = fits && CellFits(map->upload.map_encoding(), change.value());
+    }
+    
+    uint64_t version = map->version + 1;
+    RaycastWorker::MapDeltaRequest delta;
+    delta.set_map_id(map->map_id);
+    delta.set_base_version(map->version);
+    delta.set_version(version);
+    for (const auto& change : request.changes()) {
+        auto* worker_change = delta.add_changes();
+        worker_change->set_x(change.x());
+        worker_change->set_y(change.y());
+        worker_change->set_value(change.value());
+    }
+    
+    // Requests in flight only read the map's id, size and version, so the cells are edited
+    // in place. They stay expanded from the first delta on; a value the encoding cannot hold
+    // re-encodes the map once.
+    uint64_t content_hash = map->content_hash;
+    if (fits) {
+        ExpandCells(&map->upload);
+        for (const auto& change : request.changes()) {
+            content_hash = updateMapHash(content_hash, static_cast<size_t>(change.y()) * map->width + change.x(),
+                                         GetCell(map->upload, change.x(), change.y()), change.value());
+            SetCell(&map->upload, change.x(), change.y(), change.value());
+        }
+    } else {
+        std::vector<int32_t> cells = DecodeCells(map->upload);
+        for (const auto& change : request.changes()) {
+            size_t index = static_cast<size_t>(change.y()) * map->width + change.x();
+            content_hash = updateMapHash(content_hash, index, cells[index], change.value());
+            cells[index] = change.value();
+        }
+        EncodeCells(cells.data(), map->width, map->height, false, &map->upload);
+    }
+    map->content_hash = content_hash;
+    map->upload.set_content_id(formatMapId(content_hash));
+    map->upload.set_map_version(version);
+    map->history.push_back(std::move(delta));
+    if (map->history.size() > MAX_DELTA_HISTORY) {
+        map->history.erase(map->history.begin());
+    }
+    map->version = version;
+    
+    std::lock_guard<std::mutex> lock(mutex_);
+    Recount(map.get(), map->GetMemoryBytes());
+    *current_version = version;
+    return MapDeltaResult::APPLIED;
+}
+
+size_t MapStore::GetUsedBytes() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return used_bytes_;
+}
+
+int MapStore::GetMapCount() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return static_cast<int>(lru_.size());
+}
+
+void MapStore::Store(Entry map) {
+    auto it = index_.find(map->map_id);
+    if (it != index_.end()) {
+        used_bytes_ -= (*it->second)->stored_bytes;
+        lru_.erase(it->second);
+    }
+    used_bytes_ += map->stored_bytes;
+    lru_.push_front(std::move(map));
+    index_[lru_.front()->map_id] = lru_.begin();
+    Evict();
+}
+
+void MapStore::Recount(StoredMap* map, size_t bytes) {
+    // A map evicted meanwhile no longer counts
+    auto it = index_.find(map->map_id);
+    if (it == index_.end() || it->second->get() != map) {
+        return;
+    }
+    used_bytes_ = used_bytes_ - map->stored_bytes + bytes;
+    map->stored_bytes = bytes;
+    Evict();
+}
+
+// Evicts from the cold end, but always keeps the most recently used map
+void MapStore::Evict() {
+    while (used_bytes_ > capacity_bytes_ && lru_.size() > 1) {
+        const Entry& victim = lru_.back();
+        used_bytes_ -= victim->stored_bytes;
+        index_.erase(victim->map_id);
+        lru_.pop_back();
+    }
+}
+
+bool StoredMap::BuildCatchUp(uint64_t from_version, RaycastWorker::MapDeltaRequest* delta) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (from_version >= version || history.empty() || history.front().base_version() > from_version) {
+        return false;
+    }
+    
+    delta->set_map_id(map_id);
+    delta->set_base_version(from_version);
+    delta->set_version(version);
+    for (const auto& step : history) {
+        if (step.base_version() >= from_version) {
+            delta->mutable_changes()->MergeFrom(step.changes());
+        }
+    }
+    return true;
+}
+
+} // namespace RaycastMaster
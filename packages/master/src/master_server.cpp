@@ -1,13 +1,211 @@
 #include "master_server.h"
+#include "ColumnCodec.h"
+#include "MapCodec.h"
+#include "AllocationCounter.h"
 #include <iostream>
 #include <sstream>
+#include <cstdlib>
+#include <algorithm>
 
 namespace RaycastMaster {
 
+namespace {
+    // FAILED_PRECONDITION carrying the current map version, so the caller can catch up
+    grpc::Status VersionMismatch(const std::string& map_id, uint64_t current_version) {
+        MapVersionMismatch details;
+        details.set_map_id(map_id);
+        details.set_current_version(current_version);
+        return grpc::Status(grpc::StatusCode::FAILED_PRECONDITION,
+                            "Map " + map_id + " is at version " + std::to_string(current_version),
+                            details.SerializeAsString());
+    }
+    
+    // Whether a worker's packed columns, if it sent them packed, hold the columns they claim
+    bool ValidWorkerColumns(const RaycastWorker::RenderResponse& worker_response) {
+        return worker_response.result_encoding() != RaycastWorker::RESULT_ENCODING_COLUMNAR ||
+               validColumnPlanes(worker_response.columns(), worker_response.column_count());
+    }
+    
+    // Columns in a worker response, or 0 if its packed columns are malformed
+    int WorkerColumnCount(const RaycastWorker::RenderResponse& worker_response) {
+        if (worker_response.result_encoding() != RaycastWorker::RESULT_ENCODING_COLUMNAR) {
+            return worker_response.results_size();
+        }
+        int count = worker_response.column_count();
+        return validColumnPlanes(worker_response.columns(), count) ? count : 0;
+    }
+    
+    // Appends a worker's results as messages, whichever encoding the worker sent
+    void AppendResultMessages(const RaycastWorker::RenderResponse& worker_response, RaycastResponse* master_response) {
+        int count = WorkerColumnCount(worker_response);
+        if (worker_response.result_encoding() == RaycastWorker::RESULT_ENCODING_COLUMNAR) {
+            for (int i = 0; i < count; ++i) {
+                ColumnValues column = getColumn(worker_response.columns(), count, i);
+                auto* master_result = master_response->add_results();
+                
+                master_result->set_column(worker_response.start_column() + i);
+                master_result->set_distance(column.distance);
+                master_result->set_wall_type(column.wallType);
+                master_result->set_wall_x(column.wallX);
+                master_result->set_wall_top(column.wallTop);
+                master_result->set_wall_bottom(column.wallBottom);
+                master_result->set_r(column.r);
+                master_result->set_g(column.g);
+                master_result->set_b(column.b);
+            }
+            return;
+        }
+        
+        for (int i = 0; i < count; ++i) {
+            const auto& worker_result = worker_response.results(i);
+            auto* master_result = master_response->add_results();
+            
+            master_result->set_column(worker_result.column());
+            master_result->set_distance(worker_result.distance());
+            master_result->set_wall_type(worker_result.wall_type());
+            master_result->set_wall_x(worker_result.wall_x());
+            master_result->set_wall_top(worker_result.wall_top());
+            master_result->set_wall_bottom(worker_result.wall_bottom());
+            master_result->set_r(worker_result.r());
+            master_result->set_g(worker_result.g());
+            master_result->set_b(worker_result.b());
+        }
+    }
+    
+    // Writes a worker's results into planes packed for count columns, from column offset on
+    void PutResultColumns(const RaycastWorker::RenderResponse& worker_response, std::string* planes,
+                          int count, int offset) {
+        int worker_count = WorkerColumnCount(worker_response);
+        bool worker_columnar = worker_response.result_encoding() == RaycastWorker::RESULT_ENCODING_COLUMNAR;
+        for (int i = 0; i < worker_count; ++i) {
+            if (worker_columnar) {
+                putColumn(*planes, count, offset + i, getColumn(worker_response.columns(), worker_count, i));
+                continue;
+            }
+            const auto& worker_result = worker_response.results(i);
+            putColumn(*planes, count, offset + i,
+                      {static_cast<float>(worker_result.distance()), worker_result.wall_x(),
+                       worker_result.wall_type(), worker_result.wall_top(), worker_result.wall_bottom(),
+                       static_cast<uint8_t>(worker_result.r()), static_cast<uint8_t>(worker_result.g()),
+                       static_cast<uint8_t>(worker_result.b())});
+        }
+    }
+    
+    // Resets a scatter however the request using it ends, so the next request on the thread
+    // does not start with calls of this one still out
+    class ScatterGuard {
+    private:
+        FrameScatter& scatter_;
+        
+    public:
+        explicit ScatterGuard(FrameScatter& scatter) : scatter_(scatter) {}
+        ~ScatterGuard() { scatter_.Reset(); }
+        
+        ScatterGuard(const ScatterGuard&) = delete;
+        ScatterGuard& operator=(const ScatterGuard&) = delete;
+    };
+    
+    // Stores a map a client sent with a request, in either encoding, checking any map_id the
+    // client gave against its contents first. Returns nullptr with error set if the cells are
+    // malformed or smaller than the map, or the id does not match.
+    template <typename Request>
+    std::shared_ptr<const StoredMap> PutClientMap(MapStore* store, const Request& request, std::string* error) {
+        std::shared_ptr<const StoredMap> map;
+        MapPutResult result;
+        if (request.map_encoding() != MAP_ENCODING_NONE) {
+            result = store->PutEncoded(request.map_cells(),
+                                       static_cast<RaycastWorker::MapEncoding>(request.map_encoding()),
+                                       request.map_cells_compressed(), request.map_width(), request.map_height(),
+                                       request.map_id(), &map);
+        } else if (request.map_width() < 0 || request.map_height() < 0 ||
+                   static_cast<int64_t>(request.map_size()) <
+                       static_cast<int64_t>(request.map_width()) * request.map_height()) {
+            *error = "Map data smaller than map dimensions";
+            return nullptr;
+        } else {
+            result = store->Put(request.map().data(), request.map_width(), request.map_height(), request.map_id(),
+                                &map);
+        }
+        
+        switch (result) {
+            case MapPutResult::MALFORMED:
+                *error = "Malformed map_cells";
+                return nullptr;
+            case MapPutResult::ID_MISMATCH:
+                *error = "map_id does not match the map contents";
+                return nullptr;
+            case MapPutResult::STORED:
+                break;
+        }
+        return map;
+    }
+    
+    // Checks a map sent inline with a request, so a malformed one is the client's error
+    // rather than a failure of the worker it is forwarded to
+    bool CheckInlineMap(const RaycastRequest& request, std::string* error) {
+        if (request.map_encoding() != MAP_ENCODING_NONE) {
+            thread_local std::string expanded;
+            if (!mapCellData(request.map_cells(), static_cast<MapCellEncoding>(request.map_encoding()),
+                             request.map_cells_compressed(), request.map_width(), request.map_height(), expanded)) {
+                *error = "Malformed map_cells";
+                return false;
+            }
+            return true;
+        }
+        if (request.map_width() < 0 || request.map_height() < 0 ||
+            static_cast<int64_t>(request.map_size()) <
+                static_cast<int64_t>(request.map_width()) * request.map_height()) {
+            *error = "Map data smaller than map dimensions";
+            return false;
+        }
+        return true;
+    }
+}
+
 MasterServiceImpl::MasterServiceImpl() 
     : worker_pool_(std::make_unique<WorkerPool>()),
       load_balancer_(std::make_unique<LoadBalancer>(worker_pool_.get())) {
     
+    const char* mapStoreBytes = std::getenv("MAP_STORE_BYTES");
+    size_t capacityBytes = mapStoreBytes ? std::strtoull(mapStoreBytes, nullptr, 10) : (256ull << 20);
+    map_store_ = std::make_unique<MapStore>(capacityBytes);
+    
+    // Workers are picked by two random choices weighed on load and latency unless told otherwise
+    const char* strategy = std::getenv("LOAD_BALANCING_STRATEGY");
+    load_balancer_->SetStrategy(ParseLoadBalancingStrategy(strategy ? strategy : "p2c",
+                                                           LoadBalancingStrategy::POWER_OF_TWO_CHOICES));
+    
+    // Only if asked, requests naming a client go to that client's workers on a consistent hash
+    // ring instead, so its maps and frames stay warm there, until a worker has this many
+    // times the average load
+    const char* affinityLoadFactor = std::getenv("AFFINITY_LOAD_FACTOR");
+    load_balancer_->SetAffinityLoadFactor(std::max(affinityLoadFactor ? std::atof(affinityLoadFactor) : 0.0, 0.0));
+    
+    // Unary requests go to one worker unless told to split
+    const char* scatterWorkers = std::getenv("SCATTER_WORKERS");
+    scatter_workers_ = scatterWorkers ? std::atoi(scatterWorkers) : 1;
+    const char* scatterMinColumns = std::getenv("SCATTER_MIN_COLUMNS");
+    scatter_min_columns_ = std::max(scatterMinColumns ? std::atoi(scatterMinColumns) : 64, 1);
+    const char* costBucketColumns = std::getenv("SCATTER_COST_BUCKET_COLUMNS");
+    cost_bucket_columns_ = std::max(costBucketColumns ? std::atoi(costBucketColumns) : 8, 0);
+    
+    // A render still out at this percentile of its worker's recent round trips is also sent to
+    // a second worker, as long as hedges stay within their share of all renders
+    const char* hedgePercentile = std::getenv("HEDGE_PERCENTILE");
+    const char* hedgeBudgetPercent = std::getenv("HEDGE_BUDGET_PERCENT");
+    double budgetPercent = hedgeBudgetPercent ? std::atof(hedgeBudgetPercent) : 5.0;
+    hedge_budget_ = std::make_unique<RequestBudget>(std::max(budgetPercent, 0.0) / 100.0, MAX_HEDGE_TOKENS);
+    hedge_policy_.percentile = std::min(std::max(hedgePercentile ? std::atof(hedgePercentile) : 99.0, 0.0), 100.0);
+    hedge_policy_.load_balancer = load_balancer_.get();
+    hedge_policy_.budget = hedge_budget_.get();
+    
+    // A range whose worker fails is retried on another, within the same deadline and budget
+    const char* maxRetries = std::getenv("MAX_RETRIES");
+    const char* retryBudgetPercent = std::getenv("RETRY_BUDGET_PERCENT");
+    max_retries_ = std::max(maxRetries ? std::atoi(maxRetries) : 2, 0);
+    double retryPercent = retryBudgetPercent ? std::atof(retryBudgetPercent) : 10.0;
+    retry_budget_ = std::make_unique<RequestBudget>(std::max(retryPercent, 0.0) / 100.0, MAX_RETRY_TOKENS);
+    
     // Discover workers on startup
     worker_pool_->DiscoverWorkers();
     
@@ -20,40 +218,79 @@ grpc::Status MasterServiceImpl::ProcessRaycastRequest(grpc::ServerContext* conte
                                                      const RaycastRequest* request,
                                                      RaycastResponse* response) {
     auto start_time = std::chrono::high_resolution_clock::now();
+    uint64_t allocations_before = threadAllocationCount();
     
     try {
-        // Refresh workers if needed
-        worker_pool_->RefreshWorkers();
+        // Resolve the map. Inline maps are forwarded as sent: hashing and storing a map costs
+        // more than sending it along, and clients reusing one upload it and name it by map_id.
+        std::shared_ptr<const StoredMap> map;
+        if (request->map_size() > 0 || request->map_encoding() != MAP_ENCODING_NONE) {
+            std::string error;
+            if (!CheckInlineMap(*request, &error)) {
+                response->set_success(false);
+                response->set_error_message(error);
+                return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, error);
+            }
+        } else if (!request->map_id().empty()) {
+            map = map_store_->Get(request->map_id());
+            if (!map) {
+                response->set_success(false);
+                response->set_error_message("Map not found: " + request->map_id());
+                return grpc::Status(grpc::StatusCode::NOT_FOUND, "Map not found: " + request->map_id());
+            }
+            uint64_t version = map->GetVersion();
+            if (request->map_version() != 0 && request->map_version() != version) {
+                response->set_success(false);
+                response->set_error_message("Map " + map->map_id + " is at version " + std::to_string(version));
+                return VersionMismatch(map->map_id, version);
+            }
+        }
         
-        // Get available worker
-        auto worker = load_balancer_->GetNextWorker();
-        if (!worker) {
+        // The worker messages are kept per thread and reused, so building and parsing them
+        // stays off the heap once the thread has served a request of similar size
+        thread_local RaycastWorker::RenderRequest worker_request;
+        thread_local FrameScatter scatter;
+        ScatterGuard scatter_guard(scatter);
+        scatter.SetHedgePolicy(&hedge_policy_);
+        worker_request.Clear();
+        ConvertRequest(request, map.get(), &worker_request);
+        
+        // Split the columns into one range per chosen worker and render them all at once
+        int part_count = GetScatterCount(scatter_workers_, request->start_column(), request->end_column());
+        std::vector<ColumnRange> ranges;
+        std::vector<WorkerConnection*> workers;
+        if (!PlanScatter(request->client_id(), part_count, request->start_column(), request->end_column(), &ranges,
+                         &workers)) {
             response->set_success(false);
             response->set_error_message("No workers available");
             return grpc::Status(grpc::StatusCode::UNAVAILABLE, "No workers available");
         }
         
-        // Convert master request to worker request
-        RaycastWorker::RenderRequest worker_request;
-        ConvertRequest(request, &worker_request);
-        
-        // Send to worker
-        RaycastWorker::RenderResponse worker_response;
-        auto status = worker->ProcessRenderRequest(&worker_request, &worker_response);
+        // Any range failing fails the request, so the rest are cancelled as soon as one does.
+        // Retries on other workers share the request's deadline.
+        grpc::Status status;
+        auto deadline = std::min(context->deadline(),
+                                 std::chrono::system_clock::now() + WorkerConnection::GetRequestTimeout());
+        scatter.Start(worker_request, ranges, workers, deadline);
+        while (FramePart* part = NextPart(scatter, map.get())) {
+            if (!part->status.ok() && status.ok()) {
+                status = part->status;
+                scatter.CancelPending();
+            }
+        }
         
         if (status.ok()) {
-            // Convert worker response to master response
-            ConvertResponse(&worker_response, response);
-            response->set_worker_endpoint(worker->GetEndpoint());
+            // Convert worker responses to master response
+            GatherResponses(scatter, request->result_encoding(), response);
             response->set_success(true);
             
             // Update statistics
             auto end_time = std::chrono::high_resolution_clock::now();
             auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
-            UpdateStats(duration.count());
+            UpdateStats(duration.count(), static_cast<int64_t>(threadAllocationCount() - allocations_before));
             
             std::cout << "Request " << request->request_id() 
-                      << " processed by worker " << worker->GetEndpoint()
+                      << " processed by worker " << response->worker_endpoint()
                       << " in " << duration.count() << "ms" << std::endl;
         } else {
             response->set_success(false);
@@ -75,9 +312,6 @@ grpc::Status MasterServiceImpl::GetMasterStatus(grpc::ServerContext* context,
                                                const StatusRequest* request,
                                                MasterStatus* response) {
     try {
-        // Refresh workers
-        worker_pool_->RefreshWorkers();
-        
         // Get worker information
         auto worker_info = worker_pool_->GetWorkerInfo();
         
@@ -89,6 +323,8 @@ grpc::Status MasterServiceImpl::GetMasterStatus(grpc::ServerContext* context,
             total_response_time_ms_.load() / total_requests_processed_.load() : 0.0);
         response->set_timestamp(std::chrono::duration_cast<std::chrono::milliseconds>(
             std::chrono::system_clock::now().time_since_epoch()).count());
+        response->set_last_request_allocations(last_request_allocations_.load());
+        response->set_allocations_per_request(allocations_per_request_.load());
         
         // Copy worker info
         for (const auto& info : worker_info) {
@@ -100,6 +336,10 @@ grpc::Status MasterServiceImpl::GetMasterStatus(grpc::ServerContext* context,
             worker->set_total_jobs_processed(info.total_jobs_processed);
             worker->set_average_processing_time_ms(info.average_processing_time_ms);
             worker->set_last_heartbeat(info.last_heartbeat);
+            worker->set_columns_per_ms(info.columns_per_ms);
+            worker->set_partition_weight(info.partition_weight);
+            worker->set_retries(info.retries);
+            worker->set_failovers(info.failovers);
         }
         
         return grpc::Status::OK;
@@ -110,7 +350,266 @@ grpc::Status MasterServiceImpl::GetMasterStatus(grpc::ServerContext* context,
     }
 }
 
-void MasterServiceImpl::ConvertRequest(const RaycastRequest* master_request, 
+grpc::Status MasterServiceImpl::UploadMap(grpc::ServerContext* context,
+                                         const UploadMapRequest* request,
+                                         UploadMapResponse* response) {
+    std::string error;
+    auto map = PutClientMap(map_store_.get(), *request, &error);
+    if (!map) {
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, error);
+    }
+    
+    response->set_map_id(map->map_id);
+    response->set_map_version(map->GetVersion());
+    return grpc::Status::OK;
+}
+
+grpc::Status MasterServiceImpl::ApplyMapDelta(grpc::ServerContext* context,
+                                             const MapDeltaRequest* request,
+                                             MapDeltaResponse* response) {
+    uint64_t current_version = 0;
+    switch (map_store_->ApplyDelta(*request, &current_version)) {
+        case MapDeltaResult::NOT_FOUND:
+            return grpc::Status(grpc::StatusCode::NOT_FOUND, "Map not found: " + request->map_id());
+        case MapDeltaResult::STALE_VERSION:
+            return VersionMismatch(request->map_id(), current_version);
+        case MapDeltaResult::OUT_OF_BOUNDS:
+            return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Map delta changes a cell outside the map");
+        case MapDeltaResult::APPLIED:
+            break;
+    }
+    
+    // Workers pick the delta up on their next request for this map
+    response->set_map_id(request->map_id());
+    response->set_map_version(current_version);
+    return grpc::Status::OK;
+}
+
+grpc::Status MasterServiceImpl::RaycastSession(grpc::ServerContext* context,
+                                              grpc::ServerReaderWriter<RaycastChunk, RaycastSessionRequest>* stream) {
+    RaycastSessionRequest message;
+    if (!stream->Read(&message)) {
+        return grpc::Status::OK;
+    }
+    if (message.kind_case() != RaycastSessionRequest::kOpen) {
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "RaycastSession must start with an open message");
+    }
+    const RaycastSessionOpen open = message.open();
+    if (open.map_id().empty()) {
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "RaycastSession requires a map_id");
+    }
+    
+    // Each frame is rendered as this request with the frame's pose and columns
+    RaycastRequest frame_request;
+    frame_request.set_client_id(open.client_id());
+    frame_request.set_screen_width(open.screen_width());
+    frame_request.set_screen_height(open.screen_height());
+    frame_request.set_fov(open.fov());
+    frame_request.set_precision(open.precision());
+    frame_request.set_result_encoding(open.result_encoding());
+    
+    FrameScatter scatter;
+    scatter.SetHedgePolicy(&hedge_policy_);
+    RaycastWorker::RenderRequest worker_request;
+    RaycastChunk chunk;
+    // Step counts of the last frame every range came back for, and of the frame in hand
+    ColumnCosts costs;
+    ColumnCosts frame_costs;
+    while (stream->Read(&message)) {
+        if (message.kind_case() != RaycastSessionRequest::kFrame) {
+            return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "RaycastSession is already open");
+        }
+        auto start_time = std::chrono::high_resolution_clock::now();
+        uint64_t allocations_before = threadAllocationCount();
+        const RaycastFrame& frame = message.frame();
+        
+        // Deltas may land between frames, so the map is looked up for every frame
+        auto map = map_store_->Get(open.map_id());
+        if (!map) {
+            return grpc::Status(grpc::StatusCode::NOT_FOUND, "Map not found: " + open.map_id());
+        }
+        uint64_t version = map->GetVersion();
+        if (open.map_version() != 0 && open.map_version() != version) {
+            return VersionMismatch(map->map_id, version);
+        }
+        
+        frame_request.set_request_id(open.client_id() + "_" + std::to_string(frame.frame_id()));
+        *frame_request.mutable_player() = frame.player();
+        frame_request.set_start_column(frame.start_column());
+        frame_request.set_end_column(frame.end_column());
+        worker_request.Clear();
+        ConvertRequest(&frame_request, map.get(), &worker_request);
+        worker_request.set_step_bucket_columns(cost_bucket_columns_);
+        
+        // One range per worker unless the client asked for a number of chunks
+        int chunk_count = GetScatterCount(open.chunks(), frame.start_column(), frame.end_column());
+        std::vector<ColumnRange> ranges;
+        std::vector<WorkerConnection*> workers;
+        
+        // Without workers the whole frame is one failed chunk, left to the client to draw
+        if (!PlanScatter(open.client_id(), chunk_count, frame.start_column(), frame.end_column(), &ranges, &workers,
+                         &costs)) {
+            chunk.Clear();
+            chunk.set_frame_id(frame.frame_id());
+            chunk.set_start_column(frame.start_column());
+            chunk.set_end_column(frame.end_column());
+            chunk.set_chunk_count(1);
+            chunk.mutable_result()->set_request_id(frame_request.request_id());
+            chunk.mutable_result()->set_client_id(open.client_id());
+            chunk.mutable_result()->set_success(false);
+            chunk.mutable_result()->set_error_message("No workers available");
+            if (!stream->Write(chunk)) {
+                return grpc::Status::OK;
+            }
+            continue;
+        }
+        
+        auto deadline = std::min(context->deadline(),
+                                 std::chrono::system_clock::now() + WorkerConnection::GetRequestTimeout());
+        scatter.Start(worker_request, ranges, workers, deadline);
+        frame_costs.Reset(cost_bucket_columns_, frame.start_column(), frame.end_column());
+        bool costs_complete = !frame_costs.Empty();
+        while (FramePart* part = NextPart(scatter, map.get())) {
+            chunk.Clear();
+            chunk.set_frame_id(frame.frame_id());
+            chunk.set_start_column(part->columns.start_column);
+            chunk.set_end_column(part->columns.end_column);
+            chunk.set_chunk_count(static_cast<int32_t>(ranges.size()));
+            auto* result = chunk.mutable_result();
+            if (part->status.ok()) {
+                costs_complete = costs_complete && frame_costs.Add(part->columns, part->response);
+                ConvertResponse(&part->response, open.result_encoding(), result);
+                result->set_worker_endpoint(part->worker->GetEndpoint());
+                result->set_success(true);
+            } else {
+                costs_complete = false;
+                result->set_request_id(frame_request.request_id());
+                result->set_client_id(open.client_id());
+                result->set_worker_endpoint(part->worker->GetEndpoint());
+                result->set_success(false);
+                result->set_error_message(part->status.error_message());
+                std::cerr << "Worker request failed: " << part->status.error_message() << std::endl;
+            }
+            
+            // The client went away; stop the rest of the frame
+            if (!stream->Write(chunk)) {
+                scatter.CancelPending();
+                return grpc::Status::OK;
+            }
+        }
+        
+        // A frame with ranges missing would predict nothing there, so the last whole one is kept
+        if (costs_complete) {
+            std::swap(costs, frame_costs);
+        }
+        
+        auto end_time = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
+        UpdateStats(duration.count(), static_cast<int64_t>(threadAllocationCount() - allocations_before));
+    }
+    
+    return grpc::Status::OK;
+}
+
+int MasterServiceImpl::GetScatterCount(int requested, int start_column, int end_column) {
+    int count = requested > 0 ? requested : worker_pool_->GetActiveWorkers();
+    return std::max(std::min(count, (end_column - start_column) / scatter_min_columns_), 1);
+}
+
+bool MasterServiceImpl::PlanScatter(const std::string& client_id, int count, int start_column, int end_column,
+                                    std::vector<ColumnRange>* ranges, std::vector<WorkerConnection*>* workers,
+                                    const ColumnCosts* costs) {
+    if (!load_balancer_->GetWorkersForClient(client_id, count, workers)) {
+        return false;
+    }
+    
+    // A single range needs no weighing
+    if (count == 1) {
+        *ranges = {{start_column, end_column}};
+    } else if (costs) {
+        *ranges = SplitColumnsByCost(start_column, end_column, *costs, GetPartitionWeights(*workers));
+    } else {
+        *ranges = SplitColumnsByWeight(start_column, end_column, GetPartitionWeights(*workers));
+    }
+    return true;
+}
+
+FramePart* MasterServiceImpl::NextPart(FrameScatter& scatter, const StoredMap* map) {
+    while (FramePart* part = scatter.Next()) {
+        // Each range earns its share of retries once, with its first answer
+        if (part->attempts == 1) {
+            retry_budget_->Earn();
+        }
+        
+        // Columns that cannot be unpacked, or that do not cover the range, fail it like any
+        // other worker error rather than passing on as a short frame
+        if (part->status.ok() &&
+            (!ValidWorkerColumns(part->response) ||
+             WorkerColumnCount(part->response) != part->columns.end_column - part->columns.start_column)) {
+            part->status = grpc::Status(grpc::StatusCode::INTERNAL,
+                                        "Worker " + part->worker->GetEndpoint() + " returned malformed columns for " +
+                                        std::to_string(part->columns.start_column) + "-" +
+                                        std::to_string(part->columns.end_column));
+        }
+        
+        // The worker is missing this map or has an older version: sync it and resend once per
+        // worker. Parts already back have been handled, so only this range waits on the sync.
+        if (map && part->synced_worker != part->worker &&
+            (part->status.error_code() == grpc::StatusCode::NOT_FOUND ||
+             part->status.error_code() == grpc::StatusCode::FAILED_PRECONDITION)) {
+            auto sync_status = SyncWorkerMap(part->worker, *map, part->status);
+            if (sync_status.ok()) {
+                part->synced_worker = part->worker;
+                scatter.Resend(part, part->worker);
+                continue;
+            }
+            part->status = sync_status;
+        }
+        
+        // The worker failed: move the range to another healthy worker while there is time left
+        // and budget, so a brownout does not multiply its own load
+        if (IsWorkerFailure(part->status) && part->retries < max_retries_ &&
+            std::chrono::system_clock::now() < part->deadline) {
+            WorkerConnection* other = load_balancer_->GetAlternateWorker(part->worker);
+            if (other && retry_budget_->TrySpend()) {
+                std::cerr << "Retrying range " << part->columns.start_column << "-" << part->columns.end_column
+                          << " on " << other->GetEndpoint() << " after " << part->worker->GetEndpoint()
+                          << " failed: " << part->status.error_message() << std::endl;
+                part->worker->CountFailover();
+                other->CountRetry();
+                part->retries++;
+                scatter.Resend(part, other);
+                continue;
+            }
+        }
+        return part;
+    }
+    return nullptr;
+}
+
+grpc::Status MasterServiceImpl::SyncWorkerMap(WorkerConnection* worker, const StoredMap& map,
+                                              const grpc::Status& worker_status) {
+    if (worker_status.error_code() == grpc::StatusCode::FAILED_PRECONDITION) {
+        RaycastWorker::MapVersionMismatch mismatch;
+        RaycastWorker::MapDeltaRequest delta;
+        if (mismatch.ParseFromString(worker_status.error_details()) &&
+            map.BuildCatchUp(mismatch.current_version(), &delta)) {
+            RaycastWorker::MapDeltaResponse delta_response;
+            auto delta_status = worker->ApplyMapDelta(&delta, &delta_response);
+            if (delta_status.ok() || delta_status.error_code() != grpc::StatusCode::FAILED_PRECONDITION) {
+                return delta_status;
+            }
+            // The worker moved on meanwhile; fall back to a full upload
+        }
+    }
+    
+    RaycastWorker::UploadMapRequest upload;
+    map.CopyUpload(&upload);
+    RaycastWorker::UploadMapResponse upload_response;
+    return worker->UploadMap(&upload, &upload_response);
+}
+
+void MasterServiceImpl::ConvertRequest(const RaycastRequest* master_request, const StoredMap* map,
                                       RaycastWorker::RenderRequest* worker_request) {
     worker_request->set_request_id(master_request->request_id());
     worker_request->set_player_id(master_request->client_id());
@@ -131,44 +630,116 @@ void MasterServiceImpl::ConvertRequest(const RaycastRequest* master_request,
     worker_request->set_fov(master_request->fov());
     worker_request->set_start_column(master_request->start_column());
     worker_request->set_end_column(master_request->end_column());
+    worker_request->set_precision(static_cast<RaycastWorker::Precision>(master_request->precision()));
+    worker_request->set_result_encoding(static_cast<RaycastWorker::ResultEncoding>(master_request->result_encoding()));
     
-    // Convert map
-    for (int i = 0; i < master_request->map_size(); ++i) {
-        worker_request->add_map(master_request->map(i));
+    // Refer to a stored map by hash; its cells travel only with UploadMap
+    if (map) {
+        worker_request->set_map_id(map->map_id);
+        worker_request->set_map_version(map->GetVersion());
+        worker_request->set_map_width(map->width);
+        worker_request->set_map_height(map->height);
+        return;
     }
     worker_request->set_map_width(master_request->map_width());
     worker_request->set_map_height(master_request->map_height());
+    if (master_request->map_encoding() != MAP_ENCODING_NONE) {
+        worker_request->set_map_cells(master_request->map_cells());
+        worker_request->set_map_encoding(static_cast<RaycastWorker::MapEncoding>(master_request->map_encoding()));
+        worker_request->set_map_cells_compressed(master_request->map_cells_compressed());
+    } else {
+        worker_request->mutable_map()->CopyFrom(master_request->map());
+    }
 }
 
 void MasterServiceImpl::ConvertResponse(const RaycastWorker::RenderResponse* worker_response,
-                                       RaycastResponse* master_response) {
+                                       ResultEncoding result_encoding, RaycastResponse* master_response) {
     master_response->set_request_id(worker_response->request_id());
     master_response->set_client_id(worker_response->player_id());
     master_response->set_worker_id(worker_response->worker_id());
     master_response->set_timestamp(worker_response->timestamp());
     master_response->set_processing_time_ms(worker_response->processing_time_ms());
     
-    // Convert results
-    for (int i = 0; i < worker_response->results_size(); ++i) {
-        const auto& worker_result = worker_response->results(i);
-        auto* master_result = master_response->add_results();
+    int count = WorkerColumnCount(*worker_response);
+    if (result_encoding == RESULT_ENCODING_COLUMNAR) {
+        master_response->set_result_encoding(RESULT_ENCODING_COLUMNAR);
+        master_response->set_column_count(count);
+        if (worker_response->result_encoding() == RaycastWorker::RESULT_ENCODING_COLUMNAR) {
+            // Packed columns pass through as they are
+            master_response->set_start_column(worker_response->start_column());
+            if (count > 0) {
+                master_response->set_columns(worker_response->columns());
+            }
+            return;
+        }
         
-        master_result->set_column(worker_result.column());
-        master_result->set_distance(worker_result.distance());
-        master_result->set_wall_type(worker_result.wall_type());
-        master_result->set_wall_x(worker_result.wall_x());
-        master_result->set_wall_top(worker_result.wall_top());
-        master_result->set_wall_bottom(worker_result.wall_bottom());
-        master_result->set_r(worker_result.r());
-        master_result->set_g(worker_result.g());
-        master_result->set_b(worker_result.b());
+        // Workers that predate packed results send messages; pack them here
+        std::string* planes = master_response->mutable_columns();
+        resizeColumnPlanes(*planes, count);
+        master_response->set_start_column(count > 0 ? worker_response->results(0).column() : 0);
+        PutResultColumns(*worker_response, planes, count, 0);
+        return;
+    }
+    
+    AppendResultMessages(*worker_response, master_response);
+}
+
+void MasterServiceImpl::GatherResponses(const FrameScatter& scatter, ResultEncoding result_encoding,
+                                       RaycastResponse* master_response) {
+    const FramePart* first = scatter.GetPart(0);
+    if (scatter.GetPartCount() == 1) {
+        ConvertResponse(&first->response, result_encoding, master_response);
+        master_response->set_worker_endpoint(first->worker->GetEndpoint());
+        return;
+    }
+    
+    // The request took as long as its slowest range
+    master_response->set_request_id(first->response.request_id());
+    master_response->set_client_id(first->response.player_id());
+    master_response->set_worker_id(first->response.worker_id());
+    std::string* endpoints = master_response->mutable_worker_endpoint();
+    int total = 0;
+    for (size_t i = 0; i < scatter.GetPartCount(); ++i) {
+        const FramePart* part = scatter.GetPart(i);
+        master_response->set_timestamp(std::max(master_response->timestamp(), part->response.timestamp()));
+        master_response->set_processing_time_ms(
+            std::max(master_response->processing_time_ms(), part->response.processing_time_ms()));
+        if (i > 0) {
+            endpoints->push_back(',');
+        }
+        endpoints->append(part->worker->GetEndpoint());
+        total += WorkerColumnCount(part->response);
+    }
+    
+    if (result_encoding == RESULT_ENCODING_COLUMNAR) {
+        // Planes hold one field for every column, so each range is written into its slot of each plane
+        master_response->set_result_encoding(RESULT_ENCODING_COLUMNAR);
+        master_response->set_column_count(total);
+        master_response->set_start_column(first->columns.start_column);
+        std::string* planes = master_response->mutable_columns();
+        resizeColumnPlanes(*planes, total);
+        int offset = 0;
+        for (size_t i = 0; i < scatter.GetPartCount(); ++i) {
+            const FramePart* part = scatter.GetPart(i);
+            PutResultColumns(part->response, planes, total, offset);
+            offset += WorkerColumnCount(part->response);
+        }
+        return;
+    }
+    
+    for (size_t i = 0; i < scatter.GetPartCount(); ++i) {
+        AppendResultMessages(scatter.GetPart(i)->response, master_response);
     }
 }
 
-void MasterServiceImpl::UpdateStats(int64_t response_time_ms) {
+void MasterServiceImpl::UpdateStats(int64_t response_time_ms, int64_t allocations) {
     total_requests_processed_.fetch_add(1);
     double current_total = total_response_time_ms_.load();
     total_response_time_ms_.store(current_total + static_cast<double>(response_time_ms));
+    
+    last_request_allocations_.store(allocations);
+    double average = allocations_per_request_.load();
+    allocations_per_request_.store(average + ALLOCATION_AVERAGE_WEIGHT * (allocations - average));
 }
 
 // MasterServer implementation
@@ -4,9 +4,17 @@
 #include <thread>
 #include <chrono>
 #include <algorithm>
+#include <cmath>
 
 namespace RaycastMaster {
 
+namespace {
+
+// Source of snapshot versions, shared by every pool so a version names one snapshot
+std::atomic<uint64_t> next_snapshot_version{0};
+
+} // namespace
+
 // WorkerConnection implementation
 WorkerConnection::WorkerConnection(const std::string& endpoint) 
     : endpoint_(endpoint),
@@ -24,14 +32,14 @@ bool WorkerConnection::Connect() {
         
     } catch (const std::exception& e) {
         std::cerr << "Failed to connect to worker " << endpoint_ << ": " << e.what() << std::endl;
-        is_healthy_.store(false);
+        SetHealthy(false);
         return false;
     }
 }
 
 void WorkerConnection::Disconnect() {
     stub_.reset();
-    is_healthy_.store(false);
+    SetHealthy(false);
 }
 
 bool WorkerConnection::IsHealthy() {
@@ -53,12 +61,18 @@ bool WorkerConnection::IsHealthy() {
 }
 
 void WorkerConnection::MarkUnhealthy() {
-    is_healthy_.store(false);
+    SetHealthy(false);
+}
+
+void WorkerConnection::SetHealthy(bool healthy) {
+    if (is_healthy_.exchange(healthy) != healthy && on_health_change_) {
+        on_health_change_();
+    }
 }
 
 bool WorkerConnection::PerformHealthCheck() {
     if (!stub_) {
-        is_healthy_.store(false);
+        SetHealthy(false);
         return false;
     }
     
@@ -74,7 +88,7 @@ bool WorkerConnection::PerformHealthCheck() {
         auto status = stub_->GetWorkerStatus(&context, request, &response);
         bool healthy = status.ok();
         
-        is_healthy_.store(healthy);
+        SetHealthy(healthy);
         last_health_check_ = std::chrono::steady_clock::now();
         
         if (!healthy) {
@@ -87,7 +101,7 @@ bool WorkerConnection::PerformHealthCheck() {
     } catch (const std::exception& e) {
         std::cerr << "Health check exception for worker " << endpoint_ 
                   << ": " << e.what() << std::endl;
-        is_healthy_.store(false);
+        SetHealthy(false);
         return false;
     }
 }
@@ -99,10 +113,16 @@ void WorkerConnection::UpdateLastHealthCheck() {
 
 void WorkerConnection::IncrementActiveJobs() {
     active_jobs_.fetch_add(1);
+    if (pool_active_jobs_) {
+        pool_active_jobs_->fetch_add(1);
+    }
 }
 
 void WorkerConnection::DecrementActiveJobs() {
     active_jobs_.fetch_sub(1);
+    if (pool_active_jobs_) {
+        pool_active_jobs_->fetch_sub(1);
+    }
 }
 
 void WorkerConnection::UpdateJobStats(int64_t processing_time_ms) {
@@ -111,6 +131,66 @@ void WorkerConnection::UpdateJobStats(int64_t processing_time_ms) {
     total_processing_time_ms_.store(current_total + static_cast<double>(processing_time_ms));
 }
 
+void WorkerConnection::UpdateThroughput(int columns, int64_t processing_time_ms) {
+    if (columns <= 0) {
+        return;
+    }
+    
+    // Workers report whole milliseconds, rounded down, so the render took about half a
+    // millisecond more than reported
+    double columns_per_ms = columns / (static_cast<double>(processing_time_ms) + 0.5);
+    double average = columns_per_ms_.load();
+    columns_per_ms_.store(average == 0.0 ? columns_per_ms
+                                         : average + THROUGHPUT_AVERAGE_WEIGHT * (columns_per_ms - average));
+}
+
+void WorkerConnection::RecordLatency(std::chrono::steady_clock::duration latency) {
+    double latency_ms = std::chrono::duration<double, std::milli>(latency).count();
+    int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    
+    std::lock_guard<std::mutex> lock(latency_mutex_);
+    latency_ms_[latency_count_ % LATENCY_SAMPLES] = latency_ms;
+    latency_count_++;
+    
+    // A sample slower than the average replaces it whole, so a degrading worker is avoided at
+    // once; faster ones pull it down by the weight of the time since the last sample
+    double elapsed_seconds = std::max(now_ns - peak_latency_at_ns_.load(), int64_t{0}) / 1e9;
+    double weight = std::exp(-elapsed_seconds / PEAK_LATENCY_DECAY_SECONDS);
+    double peak_ms = peak_latency_ms_.load();
+    peak_latency_ms_.store(latency_ms > peak_ms ? latency_ms : peak_ms * weight + latency_ms * (1.0 - weight));
+    peak_latency_at_ns_.store(now_ns);
+}
+
+double WorkerConnection::GetPeakLatencyMs() const {
+    int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    double elapsed_seconds = std::max(now_ns - peak_latency_at_ns_.load(), int64_t{0}) / 1e9;
+    return peak_latency_ms_.load() * std::exp(-elapsed_seconds / PEAK_LATENCY_DECAY_SECONDS);
+}
+
+double WorkerConnection::GetLatencyPercentile(double percentile) {
+    std::array<double, LATENCY_SAMPLES> samples;
+    size_t count;
+    {
+        std::lock_guard<std::mutex> lock(latency_mutex_);
+        count = std::min(latency_count_, LATENCY_SAMPLES);
+        std::copy(latency_ms_.begin(), latency_ms_.begin() + count, samples.begin());
+    }
+    if (count < MIN_LATENCY_SAMPLES) {
+        return 0.0;
+    }
+    
+    size_t rank = std::min(static_cast<size_t>(percentile / 100.0 * count), count - 1);
+    std::nth_element(samples.begin(), samples.begin() + rank, samples.begin() + count);
+    return samples[rank];
+}
+
+std::chrono::seconds WorkerConnection::GetRequestTimeout() {
+    const char* requestTimeout = std::getenv("REQUEST_TIMEOUT_SECONDS");
+    return std::chrono::seconds(requestTimeout ? std::atoi(requestTimeout) : 30);
+}
+
 double WorkerConnection::GetAverageProcessingTimeMs() const {
     int total_jobs = total_jobs_processed_.load();
     if (total_jobs == 0) return 0.0;
@@ -125,9 +205,7 @@ grpc::Status WorkerConnection::ProcessRenderRequest(const RaycastWorker::RenderR
     
     try {
         grpc::ClientContext context;
-        const char* requestTimeout = std::getenv("REQUEST_TIMEOUT_SECONDS");
-        int timeoutSeconds = requestTimeout ? std::atoi(requestTimeout) : 30;
-        context.set_deadline(std::chrono::system_clock::now() + std::chrono::seconds(timeoutSeconds));
+        context.set_deadline(std::chrono::system_clock::now() + GetRequestTimeout());
         
         auto start_time = std::chrono::high_resolution_clock::now();
         IncrementActiveJobs();
@@ -136,9 +214,57 @@ grpc::Status WorkerConnection::ProcessRenderRequest(const RaycastWorker::RenderR
         
         auto end_time = std::chrono::high_resolution_clock::now();
         auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
-        UpdateJobStats(duration.count());
+        FinishRenderRequest(status, duration.count());
+        
+        return status;
         
+    } catch (const std::exception& e) {
         DecrementActiveJobs();
+        MarkUnhealthy();
+        return grpc::Status(grpc::StatusCode::INTERNAL, 
+                           std::string("Exception: ") + e.what());
+    }
+}
+
+std::unique_ptr<grpc::ClientAsyncResponseReader<RaycastWorker::RenderResponse>>
+WorkerConnection::StartRenderRequest(grpc::ClientContext* context, const RaycastWorker::RenderRequest& request,
+                                     grpc::CompletionQueue* cq, std::chrono::system_clock::time_point deadline) {
+    if (!stub_) {
+        return nullptr;
+    }
+    
+    context->set_deadline(deadline);
+    
+    IncrementActiveJobs();
+    auto reader = stub_->PrepareAsyncProcessRenderRequest(context, request, cq);
+    reader->StartCall();
+    return reader;
+}
+
+void WorkerConnection::FinishRenderRequest(const grpc::Status& status, int64_t processing_time_ms) {
+    UpdateJobStats(processing_time_ms);
+    DecrementActiveJobs();
+    
+    if (IsWorkerFailure(status)) {
+        MarkUnhealthy();
+    } else if (status.error_code() != grpc::StatusCode::CANCELLED) {
+        UpdateLastHealthCheck();
+    }
+}
+
+grpc::Status WorkerConnection::GetWorkerStatus(const RaycastWorker::StatusRequest* request,
+                                              RaycastWorker::WorkerStatus* response) {
+    if (!stub_) {
+        return grpc::Status(grpc::StatusCode::UNAVAILABLE, "Worker not connected");
+    }
+    
+    try {
+        grpc::ClientContext context;
+        const char* healthCheckTimeout = std::getenv("HEALTH_CHECK_TIMEOUT_SECONDS");
+        int timeoutSeconds = healthCheckTimeout ? std::atoi(healthCheckTimeout) : 5;
+        context.set_deadline(std::chrono::system_clock::now() + std::chrono::seconds(timeoutSeconds));
+        
+        auto status = stub_->GetWorkerStatus(&context, *request, response);
         
         if (status.ok()) {
             UpdateLastHealthCheck();
@@ -149,26 +275,23 @@ grpc::Status WorkerConnection::ProcessRenderRequest(const RaycastWorker::RenderR
         return status;
         
     } catch (const std::exception& e) {
-        DecrementActiveJobs();
         MarkUnhealthy();
         return grpc::Status(grpc::StatusCode::INTERNAL, 
                            std::string("Exception: ") + e.what());
     }
 }
 
-grpc::Status WorkerConnection::GetWorkerStatus(const RaycastWorker::StatusRequest* request,
-                                              RaycastWorker::WorkerStatus* response) {
+grpc::Status WorkerConnection::UploadMap(const RaycastWorker::UploadMapRequest* request,
+                                        RaycastWorker::UploadMapResponse* response) {
     if (!stub_) {
         return grpc::Status(grpc::StatusCode::UNAVAILABLE, "Worker not connected");
     }
     
     try {
         grpc::ClientContext context;
-        const char* healthCheckTimeout = std::getenv("HEALTH_CHECK_TIMEOUT_SECONDS");
-        int timeoutSeconds = healthCheckTimeout ? std::atoi(healthCheckTimeout) : 5;
-        context.set_deadline(std::chrono::system_clock::now() + std::chrono::seconds(timeoutSeconds));
+        context.set_deadline(std::chrono::system_clock::now() + GetRequestTimeout());
         
-        auto status = stub_->GetWorkerStatus(&context, *request, response);
+        auto status = stub_->UploadMap(&context, *request, response);
         
         if (status.ok()) {
             UpdateLastHealthCheck();
@@ -185,67 +308,234 @@ grpc::Status WorkerConnection::GetWorkerStatus(const RaycastWorker::StatusReques
     }
 }
 
+grpc::Status WorkerConnection::ApplyMapDelta(const RaycastWorker::MapDeltaRequest* request,
+                                            RaycastWorker::MapDeltaResponse* response) {
+    if (!stub_) {
+        return grpc::Status(grpc::StatusCode::UNAVAILABLE, "Worker not connected");
+    }
+    
+    try {
+        grpc::ClientContext context;
+        context.set_deadline(std::chrono::system_clock::now() + GetRequestTimeout());
+        
+        auto status = stub_->ApplyMapDelta(&context, *request, response);
+        
+        if (status.ok() || status.error_code() == grpc::StatusCode::NOT_FOUND ||
+            status.error_code() == grpc::StatusCode::FAILED_PRECONDITION) {
+            UpdateLastHealthCheck();
+        } else {
+            MarkUnhealthy();
+        }
+        
+        return status;
+        
+    } catch (const std::exception& e) {
+        MarkUnhealthy();
+        return grpc::Status(grpc::StatusCode::INTERNAL, 
+                           std::string("Exception: ") + e.what());
+    }
+}
+
+bool IsWorkerFailure(const grpc::Status& status) {
+    // A missing or outdated cached map is a normal answer from a healthy worker, and a call
+    // the master cancelled says nothing about the worker
+    switch (status.error_code()) {
+        case grpc::StatusCode::OK:
+        case grpc::StatusCode::NOT_FOUND:
+        case grpc::StatusCode::FAILED_PRECONDITION:
+        case grpc::StatusCode::CANCELLED:
+            return false;
+        default:
+            return true;
+    }
+}
+
+std::vector<double> GetPartitionWeights(const std::vector<WorkerConnection*>& workers) {
+    std::vector<double> weights;
+    weights.reserve(workers.size());
+    double measured_total = 0.0;
+    int measured = 0;
+    for (auto* worker : workers) {
+        weights.push_back(worker->GetColumnsPerMs());
+        if (weights.back() > 0.0) {
+            measured_total += weights.back();
+            measured++;
+        }
+    }
+    
+    double unmeasured = measured > 0 ? measured_total / measured : 1.0;
+    double total = 0.0;
+    for (double& weight : weights) {
+        if (weight <= 0.0) {
+            weight = unmeasured;
+        }
+        total += weight;
+    }
+    for (double& weight : weights) {
+        weight /= total;
+    }
+    return weights;
+}
+
 // WorkerPool implementation
 WorkerPool::WorkerPool(const std::string& service_name, const std::string& namespace_name)
     : worker_service_name_(service_name),
       worker_namespace_(namespace_name),
       last_discovery_(std::chrono::steady_clock::now()) {
+    {
+        std::lock_guard<std::mutex> lock(workers_mutex_);
+        PublishSnapshot();
+    }
+    maintainer_ = std::thread(&WorkerPool::Maintain, this);
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(maintenance_mutex_);
+        stopping_ = true;
+    }
+    maintenance_wake_.notify_one();
+    maintainer_.join();
+}
+
+void WorkerPool::Maintain() {
+    uint64_t swept_changes = 0;
+    std::unique_lock<std::mutex> lock(maintenance_mutex_);
+    while (true) {
+        maintenance_wake_.wait_for(lock, HEALTH_SWEEP_INTERVAL,
+                                   [this, &swept_changes] { return stopping_ || health_changes_ != swept_changes; });
+        if (stopping_) {
+            return;
+        }
+        // Taken before the checks, so a change while they run brings on another sweep
+        swept_changes = health_changes_;
+        lock.unlock();
+        
+        bool discover;
+        {
+            std::lock_guard<std::mutex> workers_lock(workers_mutex_);
+            discover = DiscoveryDue();
+        }
+        if (discover) {
+            DiscoverWorkers();
+        } else {
+            SweepHealth();
+        }
+        lock.lock();
+    }
+}
+
+void WorkerPool::NotifyHealthChange() {
+    {
+        std::lock_guard<std::mutex> lock(maintenance_mutex_);
+        health_changes_++;
+    }
+    maintenance_wake_.notify_one();
+}
+
+std::shared_ptr<WorkerConnection> WorkerPool::Connect(const std::string& endpoint) {
+    auto worker = std::make_shared<WorkerConnection>(endpoint);
+    worker->SetHealthChangeHandler([this] { NotifyHealthChange(); });
+    worker->SetActiveJobsCounter(&active_jobs_);
+    return worker;
 }
 
 void WorkerPool::DiscoverWorkers() {
-    std::lock_guard<std::mutex> lock(workers_mutex_);
-    
     try {
+        // Resolving and connecting can take seconds, so the pool stays unlocked meanwhile
         auto endpoints = GetWorkerEndpoints();
-        
-        // Remove old workers that are no longer in the endpoint list
-        workers_.erase(
-            std::remove_if(workers_.begin(), workers_.end(),
-                [&endpoints](const std::unique_ptr<WorkerConnection>& worker) {
-                    return std::find(endpoints.begin(), endpoints.end(), worker->GetEndpoint()) == endpoints.end();
-                }),
-            workers_.end()
-        );
-        
-        // Add new workers
+        std::vector<std::string> known;
+        {
+            std::lock_guard<std::mutex> lock(workers_mutex_);
+            for (const auto& worker : workers_) {
+                known.push_back(worker->GetEndpoint());
+            }
+        }
+        std::vector<std::shared_ptr<WorkerConnection>> added;
         for (const auto& endpoint : endpoints) {
-            bool exists = std::any_of(workers_.begin(), workers_.end(),
-                [&endpoint](const std::unique_ptr<WorkerConnection>& worker) {
-                    return worker->GetEndpoint() == endpoint;
-                });
+            if (std::find(known.begin(), known.end(), endpoint) == known.end()) {
+                auto worker = Connect(endpoint);
+                if (worker->WasHealthy()) {
+                    added.push_back(std::move(worker));
+                }
+            }
+        }
+        
+        {
+            std::lock_guard<std::mutex> lock(workers_mutex_);
             
-            if (!exists) {
-                auto worker = std::make_unique<WorkerConnection>(endpoint);
-                if (worker->IsHealthy()) {
-                    workers_.push_back(std::move(worker));
+            // Remove old workers that are no longer in the endpoint list
+            workers_.erase(
+                std::remove_if(workers_.begin(), workers_.end(),
+                    [&endpoints](const std::shared_ptr<WorkerConnection>& worker) {
+                        return std::find(endpoints.begin(), endpoints.end(), worker->GetEndpoint()) == endpoints.end();
+                    }),
+                workers_.end()
+            );
+            
+            // Add new workers, unless added meanwhile
+            for (auto& worker : added) {
+                const std::string& endpoint = worker->GetEndpoint();
+                bool exists = std::any_of(workers_.begin(), workers_.end(),
+                    [&endpoint](const std::shared_ptr<WorkerConnection>& other) {
+                        return other->GetEndpoint() == endpoint;
+                    });
+                if (!exists) {
                     std::cout << "Added worker: " << endpoint << std::endl;
+                    workers_.push_back(std::move(worker));
                 }
             }
+            last_discovery_ = std::chrono::steady_clock::now();
         }
-        
-        last_discovery_ = std::chrono::steady_clock::now();
+        SweepHealth();
         
     } catch (const std::exception& e) {
         std::cerr << "Exception during worker discovery: " << e.what() << std::endl;
     }
 }
 
-void WorkerPool::RefreshWorkers() {
-    if (ShouldRefreshWorkers()) {
-        DiscoverWorkers();
+std::shared_ptr<const WorkerSnapshot> WorkerPool::GetSnapshot() const {
+    // Each thread keeps the last snapshot it saw and only loads the shared pointer, which
+    // takes a lock in libstdc++, once the version moves on
+    thread_local std::shared_ptr<const WorkerSnapshot> seen;
+    if (!seen || seen->version != snapshot_version_.load()) {
+        seen = std::atomic_load(&snapshot_);
     }
+    return seen;
 }
 
-std::vector<WorkerConnection*> WorkerPool::GetHealthyWorkers() {
-    std::lock_guard<std::mutex> lock(workers_mutex_);
-    std::vector<WorkerConnection*> healthy;
+void WorkerPool::SweepHealth() {
+    std::vector<std::shared_ptr<WorkerConnection>> workers;
+    {
+        std::lock_guard<std::mutex> lock(workers_mutex_);
+        workers = workers_;
+    }
+    for (auto& worker : workers) {
+        worker->IsHealthy();
+    }
     
+    std::lock_guard<std::mutex> lock(workers_mutex_);
+    PublishSnapshot();
+}
+
+void WorkerPool::PublishSnapshot() {
+    auto snapshot = std::make_shared<WorkerSnapshot>();
     for (auto& worker : workers_) {
-        if (worker->IsHealthy()) {
-            healthy.push_back(worker.get());
+        if (worker->WasHealthy()) {
+            snapshot->workers.push_back(worker.get());
+            snapshot->owners.push_back(worker);
         }
     }
-    return healthy;
+    
+    // The current snapshot holds its workers, so none of their addresses can have been reused
+    auto current = std::atomic_load(&snapshot_);
+    if (current && current->workers == snapshot->workers) {
+        return;
+    }
+    snapshot->version = next_snapshot_version.fetch_add(1) + 1;
+    uint64_t version = snapshot->version;
+    std::atomic_store(&snapshot_, std::shared_ptr<const WorkerSnapshot>(std::move(snapshot)));
+    snapshot_version_.store(version);
 }
 
 std::vector<WorkerConnection*> WorkerPool::GetAllWorkers() {
@@ -259,20 +549,34 @@ std::vector<WorkerConnection*> WorkerPool::GetAllWorkers() {
 }
 
 void WorkerPool::AddWorker(const std::string& endpoint) {
-    std::lock_guard<std::mutex> lock(workers_mutex_);
+    {
+        std::lock_guard<std::mutex> lock(workers_mutex_);
+        
+        // Check if worker already exists
+        bool exists = std::any_of(workers_.begin(), workers_.end(),
+            [&endpoint](const std::shared_ptr<WorkerConnection>& worker) {
+                return worker->GetEndpoint() == endpoint;
+            });
+        if (exists) {
+            return;
+        }
+    }
     
-    // Check if worker already exists
+    // Connecting checks the worker's health, so it is done unlocked
+    auto worker = Connect(endpoint);
+    if (!worker->WasHealthy()) {
+        return;
+    }
+    
+    std::lock_guard<std::mutex> lock(workers_mutex_);
     bool exists = std::any_of(workers_.begin(), workers_.end(),
-        [&endpoint](const std::unique_ptr<WorkerConnection>& worker) {
-            return worker->GetEndpoint() == endpoint;
+        [&endpoint](const std::shared_ptr<WorkerConnection>& other) {
+            return other->GetEndpoint() == endpoint;
         });
-    
     if (!exists) {
-        auto worker = std::make_unique<WorkerConnection>(endpoint);
-        if (worker->IsHealthy()) {
-            workers_.push_back(std::move(worker));
-            std::cout << "Added worker: " << endpoint << std::endl;
-        }
+        workers_.push_back(std::move(worker));
+        std::cout << "Added worker: " << endpoint << std::endl;
+        PublishSnapshot();
     }
 }
 
@@ -281,11 +585,12 @@ void WorkerPool::RemoveWorker(const std::string& endpoint) {
     
     workers_.erase(
         std::remove_if(workers_.begin(), workers_.end(),
-            [&endpoint](const std::unique_ptr<WorkerConnection>& worker) {
+            [&endpoint](const std::shared_ptr<WorkerConnection>& worker) {
                 return worker->GetEndpoint() == endpoint;
             }),
         workers_.end()
     );
+    PublishSnapshot();
     
     std::cout << "Removed worker: " << endpoint << std::endl;
 }
@@ -294,7 +599,7 @@ WorkerConnection* WorkerPool::FindWorker(const std::string& endpoint) {
     std::lock_guard<std::mutex> lock(workers_mutex_);
     
     auto it = std::find_if(workers_.begin(), workers_.end(),
-        [&endpoint](const std::unique_ptr<WorkerConnection>& worker) {
+        [&endpoint](const std::shared_ptr<WorkerConnection>& worker) {
             return worker->GetEndpoint() == endpoint;
         });
     
@@ -307,27 +612,37 @@ int WorkerPool::GetTotalWorkers() {
 }
 
 int WorkerPool::GetActiveWorkers() {
-    std::lock_guard<std::mutex> lock(workers_mutex_);
-    return static_cast<int>(std::count_if(workers_.begin(), workers_.end(),
-        [](const std::unique_ptr<WorkerConnection>& worker) {
-            return worker->IsHealthy();
-        }));
+    return static_cast<int>(GetSnapshot()->workers.size());
 }
 
 std::vector<InternalWorkerInfo> WorkerPool::GetWorkerInfo() {
     std::lock_guard<std::mutex> lock(workers_mutex_);
     std::vector<InternalWorkerInfo> info;
     
+    // Weights are shared among the healthy workers only, as frames are
+    std::vector<WorkerConnection*> healthy;
+    for (const auto& worker : workers_) {
+        if (worker->WasHealthy()) {
+            healthy.push_back(worker.get());
+        }
+    }
+    std::vector<double> weights = GetPartitionWeights(healthy);
+    
     for (const auto& worker : workers_) {
         InternalWorkerInfo worker_info;
         worker_info.endpoint = worker->GetEndpoint();
         worker_info.worker_id = 0; // Will be updated from worker status
-        worker_info.status = worker->IsHealthy() ? "healthy" : "unhealthy";
+        worker_info.status = worker->WasHealthy() ? "healthy" : "unhealthy";
         worker_info.active_jobs = worker->GetActiveJobs();
         worker_info.total_jobs_processed = worker->GetTotalJobsProcessed();
         worker_info.average_processing_time_ms = worker->GetAverageProcessingTimeMs();
         worker_info.last_heartbeat = std::chrono::duration_cast<std::chrono::milliseconds>(
             std::chrono::system_clock::now().time_since_epoch()).count();
+        worker_info.columns_per_ms = worker->GetColumnsPerMs();
+        auto it = std::find(healthy.begin(), healthy.end(), worker.get());
+        worker_info.partition_weight = it != healthy.end() ? weights[it - healthy.begin()] : 0.0;
+        worker_info.retries = worker->GetRetries();
+        worker_info.failovers = worker->GetFailovers();
         
         info.push_back(worker_info);
     }
@@ -336,6 +651,7 @@ std::vector<InternalWorkerInfo> WorkerPool::GetWorkerInfo() {
 }
 
 void WorkerPool::SetDiscoveryInterval(std::chrono::seconds interval) {
+    std::lock_guard<std::mutex> lock(workers_mutex_);
     discovery_interval_ = interval;
 }
 
@@ -364,7 +680,7 @@ std::vector<std::string> WorkerPool::GetWorkerEndpoints() {
     return endpoints;
 }
 
-bool WorkerPool::ShouldRefreshWorkers() const {
+bool WorkerPool::DiscoveryDue() const {
     auto now = std::chrono::steady_clock::now();
     auto time_since_last_discovery = std::chrono::duration_cast<std::chrono::seconds>(
         now - last_discovery_);
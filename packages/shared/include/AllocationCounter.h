@@ -0,0 +1,6 @@
+#pragma once
+#include <cstdint>
+
+// Heap allocations made by the calling thread so far. Counted by the replacement global
+// operator new in AllocationCounter.cpp, which must be linked into the binary.
+uint64_t threadAllocationCount();
@@ -0,0 +1,84 @@
+#pragma once
+#include <google/protobuf/arena.h>
+#include <grpcpp/support/message_allocator.h>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Message allocator for callback unary methods that places each call's request and
+// response on a protobuf arena. Arenas are recycled between calls and each starts with
+// a block of its own, so a steady stream of similar calls stops allocating once the pool
+// has one arena per concurrent call. Calls that outgrow the block spill onto the heap,
+// and the spill is freed when the arena is recycled.
+template <typename Request, typename Response>
+class ArenaMessagePool : public grpc::MessageAllocator<Request, Response> {
+public:
+    static constexpr size_t DEFAULT_BLOCK_BYTES = 256 * 1024;
+
+private:
+    class Holder : public grpc::MessageHolder<Request, Response> {
+    private:
+        ArenaMessagePool* pool_;
+        std::unique_ptr<char[]> block_;
+        google::protobuf::Arena arena_;
+
+        static google::protobuf::ArenaOptions options(char* block, size_t blockBytes) {
+            google::protobuf::ArenaOptions options;
+            options.initial_block = block;
+            options.initial_block_size = blockBytes;
+            return options;
+        }
+
+    public:
+        Holder(ArenaMessagePool* pool, size_t blockBytes)
+            : pool_(pool), block_(new char[blockBytes]), arena_(options(block_.get(), blockBytes)) {
+            createMessages();
+        }
+
+        // Drops the last call's messages and creates fresh ones in the same block
+        void reset() {
+            arena_.Reset();
+            createMessages();
+        }
+
+        void Release() override { pool_->recycle(this); }
+
+    private:
+        void createMessages() {
+            this->set_request(google::protobuf::Arena::CreateMessage<Request>(&arena_));
+            this->set_response(google::protobuf::Arena::CreateMessage<Response>(&arena_));
+        }
+    };
+
+    size_t blockBytes_;
+    std::mutex mutex_;
+    std::vector<Holder*> free_;
+    std::vector<std::unique_ptr<Holder>> all_;
+
+public:
+    explicit ArenaMessagePool(size_t blockBytes = DEFAULT_BLOCK_BYTES) : blockBytes_(blockBytes) {}
+
+    ArenaMessagePool(const ArenaMessagePool&) = delete;
+    ArenaMessagePool& operator=(const ArenaMessagePool&) = delete;
+
+    grpc::MessageHolder<Request, Response>* AllocateMessages() override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!free_.empty()) {
+            Holder* holder = free_.back();
+            free_.pop_back();
+            return holder;
+        }
+        all_.push_back(std::make_unique<Holder>(this, blockBytes_));
+        free_.reserve(all_.size());
+        return all_.back().get();
+    }
+
+private:
+    // Resets outside the lock; the holder is only handed out again once back on the list
+    void recycle(Holder* holder) {
+        holder->reset();
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(holder);
+    }
+};
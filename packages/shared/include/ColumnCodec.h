@@ -0,0 +1,86 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cmath>
+#include <string>
+
+// Columnar encoding of render results for the `columns` bytes fields. Each field is a
+// separate plane of count little-endian values, in this order:
+//   float32 distance, uint16 wall_x, int16 wall_top, int16 wall_bottom,
+//   uint8 wall_type, uint8 r, uint8 g, uint8 b
+// wall_x keeps only the fractional part of the hit coordinate (the texture position within
+// the cell), in 1/65535ths.
+// Column i of the planes is screen column start_column + i.
+constexpr size_t COLUMN_BYTES = 14;
+
+struct ColumnValues {
+    float distance;
+    double wallX;
+    int wallType;
+    int wallTop;
+    int wallBottom;
+    uint8_t r, g, b;
+};
+
+inline bool validColumnPlanes(const std::string& planes, int count) {
+    return count >= 0 && planes.size() == static_cast<size_t>(count) * COLUMN_BYTES;
+}
+
+// Sizes planes for count columns; every column must then be written with putColumn
+inline void resizeColumnPlanes(std::string& planes, int count) {
+    planes.resize(static_cast<size_t>(count) * COLUMN_BYTES);
+}
+
+inline void putColumn(std::string& planes, int count, int index, const ColumnValues& column) {
+    size_t n = static_cast<size_t>(count);
+    size_t i = static_cast<size_t>(index);
+    unsigned char* data = reinterpret_cast<unsigned char*>(&planes[0]);
+    auto put16 = [&](size_t offset, uint16_t value) {
+        data[offset] = static_cast<unsigned char>(value);
+        data[offset + 1] = static_cast<unsigned char>(value >> 8);
+    };
+    auto clamp16 = [](int value) {
+        return static_cast<uint16_t>(static_cast<int16_t>(value < -32768 ? -32768 : value > 32767 ? 32767 : value));
+    };
+
+    uint32_t distanceBits;
+    std::memcpy(&distanceBits, &column.distance, sizeof(distanceBits));
+    for (int b = 0; b < 4; b++) {
+        data[4 * i + b] = static_cast<unsigned char>(distanceBits >> (8 * b));
+    }
+    // wallX is an absolute world coordinate; texturing only needs its position within the cell
+    double fraction = std::isfinite(column.wallX) ? column.wallX - std::floor(column.wallX) : 0.0;
+    put16(4 * n + 2 * i, static_cast<uint16_t>(std::lround(fraction * 65535.0)));
+    put16(6 * n + 2 * i, clamp16(column.wallTop));
+    put16(8 * n + 2 * i, clamp16(column.wallBottom));
+    data[10 * n + i] = static_cast<unsigned char>(column.wallType);
+    data[11 * n + i] = column.r;
+    data[12 * n + i] = column.g;
+    data[13 * n + i] = column.b;
+}
+
+// planes must be valid for count columns
+inline ColumnValues getColumn(const std::string& planes, int count, int index) {
+    size_t n = static_cast<size_t>(count);
+    size_t i = static_cast<size_t>(index);
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(planes.data());
+    auto get16 = [&](size_t offset) {
+        return static_cast<uint16_t>(data[offset] | (data[offset + 1] << 8));
+    };
+
+    ColumnValues column;
+    uint32_t distanceBits = 0;
+    for (int b = 0; b < 4; b++) {
+        distanceBits |= static_cast<uint32_t>(data[4 * i + b]) << (8 * b);
+    }
+    std::memcpy(&column.distance, &distanceBits, sizeof(distanceBits));
+    column.wallX = get16(4 * n + 2 * i) / 65535.0;
+    column.wallTop = static_cast<int16_t>(get16(6 * n + 2 * i));
+    column.wallBottom = static_cast<int16_t>(get16(8 * n + 2 * i));
+    column.wallType = data[10 * n + i];
+    column.r = data[11 * n + i];
+    column.g = data[12 * n + i];
+    column.b = data[13 * n + i];
+    return column;
+}
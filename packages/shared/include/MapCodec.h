@@ -0,0 +1,150 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Compact encodings for the `map_cells` bytes fields, an alternative to sending each cell
+// as a varint. Values match the MapEncoding enum in the protos.
+enum class MapCellEncoding {
+    NONE = 0,   // No map_cells; cells travel as repeated int32
+    UINT8 = 1,  // One byte per cell, row-major
+    BITSET = 2  // One bit per cell, set for walls (value 1), LSB first, each row padded to a whole byte
+};
+
+inline size_t mapBitsetRowBytes(int width) {
+    return (static_cast<size_t>(width) + 7) / 8;
+}
+
+// Size of the encoded cells before run-length compression
+inline size_t mapCellBytes(MapCellEncoding encoding, int width, int height) {
+    switch (encoding) {
+        case MapCellEncoding::UINT8:
+            return static_cast<size_t>(width) * height;
+        case MapCellEncoding::BITSET:
+            return mapBitsetRowBytes(width) * height;
+        default:
+            return 0;
+    }
+}
+
+// Run-length compression as (varint run length, byte value) pairs. Walls and floor come in
+// long runs, so bitsets in particular shrink well.
+inline std::string compressMapRuns(const uint8_t* data, size_t size) {
+    std::string out;
+    size_t i = 0;
+    while (i < size) {
+        size_t run = 1;
+        while (i + run < size && data[i + run] == data[i]) {
+            run++;
+        }
+        for (size_t n = run; ; n >>= 7) {
+            if (n < 0x80) {
+                out.push_back(static_cast<char>(n));
+                break;
+            }
+            out.push_back(static_cast<char>((n & 0x7f) | 0x80));
+        }
+        out.push_back(static_cast<char>(data[i]));
+        i += run;
+    }
+    return out;
+}
+
+// Expands runs into exactly size bytes. Returns false if the runs are malformed or expand
+// to any other size.
+inline bool expandMapRuns(const std::string& data, size_t size, std::string& out) {
+    out.clear();
+    out.reserve(size);
+    size_t i = 0;
+    while (i < data.size()) {
+        uint64_t run = 0;
+        int shift = 0;
+        while (true) {
+            if (i >= data.size() || shift > 56) return false;
+            uint8_t byte = static_cast<uint8_t>(data[i++]);
+            run |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) break;
+            shift += 7;
+        }
+        if (i >= data.size() || run == 0 || run > size - out.size()) return false;
+        out.append(static_cast<size_t>(run), data[i++]);
+    }
+    return out.size() == size;
+}
+
+// Smallest encoding that keeps every cell value, or NONE if some value does not fit a byte
+inline MapCellEncoding smallestMapEncoding(const int32_t* cells, size_t count) {
+    bool binary = true;
+    for (size_t i = 0; i < count; i++) {
+        if (static_cast<uint32_t>(cells[i]) > 0xff) return MapCellEncoding::NONE;
+        binary &= cells[i] <= 1;
+    }
+    return binary ? MapCellEncoding::BITSET : MapCellEncoding::UINT8;
+}
+
+// Encodes width * height row-major cells, without run-length compression. BITSET keeps only
+// which cells are walls; other values read back as 0.
+inline std::string encodeMapCells(const int32_t* cells, int width, int height, MapCellEncoding encoding) {
+    std::string out(mapCellBytes(encoding, width, height), '\0');
+    if (encoding == MapCellEncoding::UINT8) {
+        for (size_t i = 0; i < out.size(); i++) {
+            out[i] = static_cast<char>(cells[i]);
+        }
+    } else if (encoding == MapCellEncoding::BITSET) {
+        size_t rowBytes = mapBitsetRowBytes(width);
+        for (int y = 0; y < height; y++) {
+            const int32_t* row = cells + static_cast<size_t>(y) * width;
+            char* bits = &out[y * rowBytes];
+            for (int x = 0; x < width; x++) {
+                if (row[x] == 1) {
+                    bits[x >> 3] = static_cast<char>(bits[x >> 3] | (1 << (x & 7)));
+                }
+            }
+        }
+    }
+    return out;
+}
+
+// The encoded cells of a map_cells field, expanding runs into scratch when compressed.
+// Returns nullptr if the data is malformed or shorter than the map.
+inline const uint8_t* mapCellData(const std::string& data, MapCellEncoding encoding, bool runLength,
+                                  int width, int height, std::string& scratch) {
+    if (width < 0 || height < 0 ||
+        (encoding != MapCellEncoding::UINT8 && encoding != MapCellEncoding::BITSET)) {
+        return nullptr;
+    }
+    size_t size = mapCellBytes(encoding, width, height);
+    if (runLength) {
+        if (!expandMapRuns(data, size, scratch)) return nullptr;
+        return reinterpret_cast<const uint8_t*>(scratch.data());
+    }
+    if (data.size() < size) return nullptr;
+    return reinterpret_cast<const uint8_t*>(data.data());
+}
+
+// Decodes a map_cells field into width * height row-major cells. Returns false if the data
+// is malformed or shorter than the map.
+inline bool decodeMapCells(const std::string& data, MapCellEncoding encoding, bool runLength,
+                           int width, int height, std::vector<int32_t>& cells) {
+    std::string scratch;
+    const uint8_t* bytes = mapCellData(data, encoding, runLength, width, height, scratch);
+    if (!bytes) return false;
+
+    cells.resize(static_cast<size_t>(width) * height);
+    if (encoding == MapCellEncoding::UINT8) {
+        for (size_t i = 0; i < cells.size(); i++) {
+            cells[i] = bytes[i];
+        }
+    } else {
+        size_t rowBytes = mapBitsetRowBytes(width);
+        for (int y = 0; y < height; y++) {
+            const uint8_t* bits = bytes + y * rowBytes;
+            int32_t* row = &cells[static_cast<size_t>(y) * width];
+            for (int x = 0; x < width; x++) {
+                row[x] = (bits[x >> 3] >> (x & 7)) & 1;
+            }
+        }
+    }
+    return true;
+}
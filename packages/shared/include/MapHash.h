@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// Content hash identifying a map's cells across the master and workers. It is a sum of one
+// mixed term for the dimensions and one per cell, keyed by the cell's row-major index, so a
+// delta updates it per changed cell instead of rehashing the whole map.
+inline uint64_t mixMapHash(uint64_t value) {
+    value += 0x9e3779b97f4a7c15ull;
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9ull;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111ebull;
+    value ^= value >> 31;
+    return value;
+}
+
+inline uint64_t mapCellHash(size_t index, int32_t value) {
+    return mixMapHash((static_cast<uint64_t>(index) << 32) | static_cast<uint32_t>(value));
+}
+
+inline uint64_t computeMapHash(const int32_t* cells, size_t count, int width, int height) {
+    uint64_t hash = mixMapHash(~((static_cast<uint64_t>(static_cast<uint32_t>(width)) << 32) |
+                                 static_cast<uint32_t>(height)));
+    for (size_t i = 0; i < count; i++) {
+        hash += mapCellHash(i, cells[i]);
+    }
+    return hash;
+}
+
+// The hash after one cell changes from oldValue to newValue
+inline uint64_t updateMapHash(uint64_t hash, size_t index, int32_t oldValue, int32_t newValue) {
+    return hash - mapCellHash(index, oldValue) + mapCellHash(index, newValue);
+}
+
+// A hash as the 16 hex digits maps are named by
+inline std::string formatMapId(uint64_t hash) {
+    static const char digits[] = "0123456789abcdef";
+    std::string id(16, '0');
+    for (int i = 15; i >= 0; i--) {
+        id[i] = digits[hash & 0xf];
+        hash >>= 4;
+    }
+    return id;
+}
+
+inline std::string computeMapId(const int32_t* cells, size_t count, int width, int height) {
+    return formatMapId(computeMapHash(cells, count, width, height));
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// Per-column cost histogram for the `column_steps` bytes fields: the DDA steps taken by the
+// rays of each bucket of bucketColumns screen columns, one varint per bucket. Buckets are
+// aligned to multiples of bucketColumns, bucket k covering columns k * bucketColumns up to
+// (k + 1) * bucketColumns, so the ranges a frame was split into add up bucket by bucket.
+// A field holds every bucket that overlaps start_column..end_column, first to last.
+
+// Bucket holding column, rounding down for columns left of the screen
+inline int stepBucketOf(int column, int bucketColumns) {
+    return column >= 0 ? column / bucketColumns : -((bucketColumns - 1 - column) / bucketColumns);
+}
+
+// Buckets overlapping the half-open range startColumn..endColumn
+inline size_t stepBucketCount(int startColumn, int endColumn, int bucketColumns) {
+    if (endColumn <= startColumn) return 0;
+    return static_cast<size_t>(stepBucketOf(endColumn - 1, bucketColumns) - stepBucketOf(startColumn, bucketColumns)) + 1;
+}
+
+inline void appendStepBucket(std::string& out, uint64_t steps) {
+    while (steps >= 0x80) {
+        out.push_back(static_cast<char>((steps & 0x7f) | 0x80));
+        steps >>= 7;
+    }
+    out.push_back(static_cast<char>(steps));
+}
+
+// Adds the buckets of a column_steps field to steps[0..count). Returns false, possibly after
+// adding some, unless data holds exactly count well-formed buckets.
+inline bool addStepBuckets(const std::string& data, uint64_t* steps, size_t count) {
+    size_t i = 0;
+    size_t bucket = 0;
+    while (i < data.size()) {
+        uint64_t value = 0;
+        int shift = 0;
+        while (true) {
+            if (i >= data.size() || shift > 63) return false;
+            uint8_t byte = static_cast<uint8_t>(data[i++]);
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) break;
+            shift += 7;
+        }
+        if (bucket >= count) return false;
+        steps[bucket++] += value;
+    }
+    return bucket == count;
+}
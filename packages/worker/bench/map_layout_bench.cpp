@@ -0,0 +1,208 @@
+// packages/worker/bench/map_layout_bench.cpp
+//
+// Compares the ROW_MAJOR and TILED occupancy layouts per ray direction, through the same
+// traversals renderColumns uses: ray packets on a dense map and the block-skipping scalar
+// walk on an open one. Reports time per ray, the cache lines of cell bits each ray's cell
+// tests touch, and hardware cache misses per ray when perf counters are available.
+//
+// Usage: map_layout_bench [map_size] [rays_per_direction]
+#include "raycast_engine.h"
+#include "ray_packet.h"
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using namespace RaycastWorker;
+
+namespace {
+
+constexpr int NUM_DIRECTIONS = 8; // 0 to 157.5 degrees; the opposite directions behave alike
+constexpr int CACHE_LINE = 64;
+using Packet = RayPacket<DoublePrecision>;
+
+// Hardware cache miss counter for this thread, or unavailable (-1) without perf access
+class CacheMissCounter {
+private:
+    int fd_;
+
+public:
+    CacheMissCounter() {
+        perf_event_attr attr{};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+    ~CacheMissCounter() {
+        if (fd_ >= 0) close(fd_);
+    }
+
+    bool available() const { return fd_ >= 0; }
+
+    void start() {
+        if (fd_ < 0) return;
+        ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    long long stop() {
+        if (fd_ < 0) return -1;
+        ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+        long long count = 0;
+        if (read(fd_, &count, sizeof(count)) != sizeof(count)) return -1;
+        return count;
+    }
+};
+
+// A packet of adjacent rays from one position, like the columns of one frame
+struct RayGroup {
+    double x, y;
+    double dirX[Packet::WIDTH], dirY[Packet::WIDTH];
+};
+
+// Cell-by-cell walk of one ray, counting each change of cache line in the plane cell tests read
+long long countLinesTouched(const OccupancyGrid& grid, double x, double y, double dirX, double dirY) {
+    bool tiled = grid.layout() == CellLayout::TILED;
+    RayState<> state = RaycastEngine::initRay(dirX, dirY, x, y);
+    long long lines = 0;
+    uintptr_t lastLine = UINTPTR_MAX;
+    while (true) {
+        state.advance();
+        if (!grid.inBounds(state.mapX, state.mapY)) break;
+        const uint64_t* word = tiled ? &grid.tileData()[grid.tileIndex(state.mapX, state.mapY)]
+                                     : &grid.rowData()[static_cast<size_t>(state.mapY) * grid.rowWords() + (state.mapX >> 6)];
+        uintptr_t line = reinterpret_cast<uintptr_t>(word) / CACHE_LINE;
+        if (line != lastLine) {
+            lines++;
+            lastLine = line;
+        }
+        if (grid.isWall(state.mapX, state.mapY)) break;
+    }
+    return lines;
+}
+
+struct Result {
+    double nsPerRay;
+    double linesPerRay;
+    double missesPerRay; // Negative when counters are unavailable
+    long long checksum;  // Of the cells the rays stopped in, which must not depend on the layout
+};
+
+Result run(const OccupancyGrid& grid, const std::vector<RayGroup>& groups, bool packets, CacheMissCounter& counter) {
+    long long lines = 0;
+    for (const RayGroup& group : groups) {
+        for (int i = 0; i < Packet::WIDTH; i++) {
+            lines += countLinesTouched(grid, group.x, group.y, group.dirX[i], group.dirY[i]);
+        }
+    }
+
+    long long checksum = 0;
+    counter.start();
+    auto start = std::chrono::steady_clock::now();
+    for (const RayGroup& group : groups) {
+        RayState<> rays[Packet::WIDTH];
+        for (int i = 0; i < Packet::WIDTH; i++) {
+            rays[i] = RaycastEngine::initRay(group.dirX[i], group.dirY[i], group.x, group.y);
+        }
+        if (packets) {
+            Packet::traverse(rays, Packet::WIDTH, grid);
+        } else {
+            for (int i = 0; i < Packet::WIDTH; i++) {
+                RaycastEngine::traverse(rays[i], grid);
+            }
+        }
+        for (int i = 0; i < Packet::WIDTH; i++) {
+            checksum += rays[i].mapX + rays[i].mapY;
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    long long misses = counter.stop();
+
+    double n = static_cast<double>(groups.size()) * Packet::WIDTH;
+    return {std::chrono::duration<double, std::nano>(end - start).count() / n, lines / n,
+            misses >= 0 ? misses / n : -1.0, checksum};
+}
+
+// Walls at the given density inside a solid border
+std::vector<int32_t> makeMap(int size, double density, std::mt19937& rng) {
+    std::vector<int32_t> cells(static_cast<size_t>(size) * size, 0);
+    std::bernoulli_distribution wall(density);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            bool border = x == 0 || y == 0 || x == size - 1 || y == size - 1;
+            cells[static_cast<size_t>(y) * size + x] = border || wall(rng) ? 1 : 0;
+        }
+    }
+    return cells;
+}
+
+// Returns false if the layouts disagree on where any ray stops
+bool compare(const char* name, const std::vector<int32_t>& cells, int size, int raysPerDirection,
+             std::mt19937& rng, CacheMissCounter& counter) {
+    MapView map(cells.data(), size, size);
+    OccupancyGrid rowMajor(map, CellLayout::ROW_MAJOR);
+    OccupancyGrid tiled(map, CellLayout::TILED);
+    // renderColumns picks the traversal the same way
+    bool packets = rowMajor.emptyFraction() < 0.5;
+
+    std::printf("\n%s map: %.0f%% empty 4x4 blocks, %s traversal\n", name, rowMajor.emptyFraction() * 100,
+                packets ? "packet" : "scalar block-skipping");
+    std::printf("%8s  %22s  %22s  %22s\n", "", "ns/ray", "cache lines/ray", "cache misses/ray");
+    std::printf("%8s  %10s %11s  %10s %11s  %10s %11s\n", "degrees",
+                "row-major", "tiled", "row-major", "tiled", "row-major", "tiled");
+
+    std::uniform_real_distribution<double> position(1.0, size - 1.0);
+    std::uniform_real_distribution<double> jitter(-M_PI / (2 * NUM_DIRECTIONS), M_PI / (2 * NUM_DIRECTIONS));
+    const double columnAngle = 0.001; // Roughly one column of a 1024-wide, 60 degree view
+    for (int d = 0; d < NUM_DIRECTIONS; d++) {
+        double center = d * M_PI / NUM_DIRECTIONS;
+        std::vector<RayGroup> groups(raysPerDirection / Packet::WIDTH);
+        for (RayGroup& group : groups) {
+            do {
+                group.x = position(rng);
+                group.y = position(rng);
+            } while (map.isWall(static_cast<int>(group.x), static_cast<int>(group.y)));
+            double angle = center + jitter(rng) + (rng() % 2 ? M_PI : 0.0);
+            for (int i = 0; i < Packet::WIDTH; i++) {
+                group.dirX[i] = std::cos(angle + i * columnAngle);
+                group.dirY[i] = std::sin(angle + i * columnAngle);
+            }
+        }
+
+        Result a = run(rowMajor, groups, packets, counter);
+        Result b = run(tiled, groups, packets, counter);
+        std::printf("%8.1f  %10.1f %11.1f  %10.1f %11.1f  %10.1f %11.1f\n", center * 180 / M_PI,
+                    a.nsPerRay, b.nsPerRay, a.linesPerRay, b.linesPerRay, a.missesPerRay, b.missesPerRay);
+        if (a.checksum != b.checksum) {
+            std::printf("layouts disagree on the cells hit\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    int size = argc > 1 ? std::atoi(argv[1]) : 2048;
+    int raysPerDirection = argc > 2 ? std::atoi(argv[2]) : 20000;
+
+    CacheMissCounter counter;
+    std::printf("map %dx%d, %d rays per direction, cache miss counters %s\n", size, size, raysPerDirection,
+                counter.available() ? "on" : "unavailable");
+
+    std::mt19937 rng(1234);
+    bool ok = compare("dense", makeMap(size, 0.05, rng), size, raysPerDirection, rng, counter);
+    ok = compare("open", makeMap(size, 0.0005, rng), size, raysPerDirection, rng, counter) && ok;
+    return ok ? 0 : 1;
+}
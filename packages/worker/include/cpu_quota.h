@@ -0,0 +1,11 @@
+// packages/worker/include/cpu_quota.h
+#pragma once
+
+namespace RaycastWorker {
+
+// CPUs this process can actually use: the cgroup CPU quota (v2 cpu.max or v1 CFS quota),
+// rounded up, capped by the scheduler affinity mask and the host core count. Containers
+// limited to a fraction of the node would otherwise size their threads for the whole node.
+int availableCpuCount();
+
+} // namespace RaycastWorker
@@ -0,0 +1,35 @@
+// packages/worker/include/direction_table.h
+#pragma once
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+namespace RaycastWorker {
+
+// Per-column ray offsets for one (screenWidth, fov) pair. Column x looks along
+// cosOffset[x] * dir + sinOffset[x] * plane, where plane is dir rotated by 90 degrees,
+// so building a frame's rays needs no trig beyond the camera direction itself. Fixed
+// point tables take the offsets from FixedPoint16's own trig, so they match on every
+// worker; the others from libm.
+class DirectionTable {
+private:
+    int screenWidth_;
+    double fov_;
+    bool fixedPoint_;
+    std::vector<double> cosOffset_;
+    std::vector<double> sinOffset_;
+    
+public:
+    DirectionTable(int screenWidth, double fov, bool fixedPoint);
+    
+    int screenWidth() const { return screenWidth_; }
+    double fov() const { return fov_; }
+    bool fixedPoint() const { return fixedPoint_; }
+    double cosOffset(int column) const { return cosOffset_[column]; }
+    double sinOffset(int column) const { return sinOffset_[column]; }
+    
+    // Shared table for this resolution, built on first use and cached afterwards
+    static std::shared_ptr<const DirectionTable> get(int screenWidth, double fov, bool fixedPoint);
+};
+
+} // namespace RaycastWorker
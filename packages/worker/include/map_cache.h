@@ -0,0 +1,117 @@
+// packages/worker/include/map_cache.h
+#pragma once
+#include "map_view.h"
+#include "occupancy_grid.h"
+#include "thread_pool.h"
+#include "visibility_set.h"
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace RaycastWorker {
+
+// One cell of a map delta
+struct MapCellChange {
+    int x, y;
+    int32_t value;
+};
+
+// A map uploaded once and shared by every request that names it. The occupancy bits are
+// built when it is cached; the visible sets take much longer, so they are built in the
+// background and published once ready, and again after every delta.
+//
+// Deltas edit the cells and occupancy bits in place, so renders hold mutex shared while
+// they read them and the version.
+struct CachedMap {
+    std::string id; // Content hash of the map's first version
+    int width = 0;
+    int height = 0;
+    mutable std::shared_mutex mutex;
+    uint64_t version = 1;
+    uint64_t contentHash = 0; // Of the current version's cells
+    std::vector<int32_t> cells; // Row-major
+    OccupancyGrid grid;
+    std::shared_ptr<const VisibilitySet> visibility; // Null until built; use visibleSet()
+    std::atomic<bool> visibilityQueued{false};
+    size_t accountedBytes = 0; // As counted by the cache; guarded by its mutex
+
+    MapView view() const {
+        return MapView(cells.data(), width, height);
+    }
+    std::shared_ptr<const VisibilitySet> visibleSet() const { return std::atomic_load(&visibility); }
+    size_t memoryBytes() const;
+
+    // Overwrites one in-bounds cell and updates the derived data around it
+    void setCell(int x, int y, int32_t value);
+};
+
+// Maps keyed by the content hash of their first version, evicting the least recently used
+// once the cached maps exceed a byte budget. Entries are shared, so an evicted map stays
+// valid for requests still rendering with it.
+class MapCache {
+private:
+    using Entry = std::shared_ptr<CachedMap>;
+
+    size_t capacityBytes_;
+    CellLayout layout_; // Of the occupancy bits built for cached maps
+    size_t usedBytes_;
+    std::list<Entry> lru_; // Most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    mutable std::mutex mutex_; // Taken after a map's own mutex, never before
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+    std::atomic<uint64_t> evictions_;
+
+    std::atomic<bool> closing_;
+    ThreadPool visibilityBuilder_; // One thread, so builds never compete with renders for more
+
+public:
+    enum class DeltaResult {
+        APPLIED,
+        NOT_FOUND,
+        STALE_VERSION,
+        INVALID_VERSION, // newVersion does not come after baseVersion
+        OUT_OF_BOUNDS
+    };
+
+    explicit MapCache(size_t capacityBytes, CellLayout layout = CellLayout::ROW_MAJOR);
+    ~MapCache();
+
+    // Returns nullptr on a miss
+    std::shared_ptr<const CachedMap> find(const std::string& id);
+
+    // Caches a map from row-major cells hashing to contentHash, then queues its visible sets
+    // to be built. If id is already cached with these cells, the existing entry is returned,
+    // at this version, and cells are dropped; any other map cached under id is replaced.
+    std::shared_ptr<const CachedMap> insert(const std::string& id, uint64_t contentHash, std::vector<int32_t> cells,
+                                            int width, int height, uint64_t version = 1);
+
+    // Applies changes in place to the map at baseVersion, producing newVersion. Renders of
+    // the map wait for the delta, and the ones after it see the new cells.
+    // currentVersion receives the cached version afterwards, or the mismatching one.
+    DeltaResult applyDelta(const std::string& id, uint64_t baseVersion, uint64_t newVersion,
+                           const std::vector<MapCellChange>& changes, uint64_t& currentVersion);
+
+    size_t usedBytes() const;
+    size_t size() const;
+    uint64_t hits() const { return hits_.load(); }
+    uint64_t misses() const { return misses_.load(); }
+    uint64_t evictions() const { return evictions_.load(); }
+
+private:
+    Entry lookup(const std::string& id); // Without counting a hit or miss
+    void touch(std::list<Entry>::iterator it);
+    void store(Entry map);         // Caller holds mutex_
+    void recount(CachedMap* map);  // Caller holds mutex_
+    void evict();                  // Caller holds mutex_
+    void queueVisibility(const Entry& map);
+    void buildVisibility(std::weak_ptr<CachedMap> map);
+};
+
+} // namespace RaycastWorker
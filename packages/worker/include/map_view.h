@@ -0,0 +1,42 @@
+// packages/worker/include/map_view.h
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+namespace RaycastWorker {
+
+// Read-only, row-major view over a map's cells. Does not own the storage, so it
+// can wrap the request's repeated int32 map field directly without copying.
+class MapView {
+private:
+    const int32_t* cells_;
+    int width_;
+    int height_;
+
+public:
+    MapView() : cells_(nullptr), width_(0), height_(0) {}
+    MapView(const int32_t* cells, int width, int height)
+        : cells_(cells), width_(width), height_(height) {}
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    size_t size() const { return static_cast<size_t>(width_) * height_; }
+    const int32_t* data() const { return cells_; }
+    bool empty() const { return cells_ == nullptr || size() == 0; }
+
+    bool inBounds(int x, int y) const {
+        return x >= 0 && x < width_ && y >= 0 && y < height_;
+    }
+
+    // Unchecked cell access; callers must bounds-check first
+    int32_t at(int x, int y) const {
+        return cells_[static_cast<size_t>(y) * width_ + x];
+    }
+
+    // Out-of-bounds cells are treated as solid
+    bool isWall(int x, int y) const {
+        return !inBounds(x, y) || at(x, y) == 1;
+    }
+};
+
+} // namespace RaycastWorker
@@ -0,0 +1,140 @@
+// packages/worker/include/occupancy_grid.h
+#pragma once
+#include "map_view.h"
+#include "worker_types.h"
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace RaycastWorker {
+
+// Range of row-major cell indices [start, start + length)
+struct CellRun {
+    uint32_t start;
+    uint32_t length;
+};
+
+// Bit-packed wall occupancy, 1 bit per cell in 64-bit words. Stored twice: row-major for
+// runs along X and column-major for runs along Y, so both axes can be scanned a word at a
+// time. Padding bits past the map edge are set, so runs always stop at the boundary.
+//
+// Coarser levels record which aligned 64x64, 16x16 and 4x4 blocks contain no walls at all, so
+// traversal can cross an empty block in one jump. Blocks reaching past the edge count as occupied.
+//
+// With the TILED layout the cells are stored a third time as 8x8 tiles, and single-cell tests
+// read those instead of the rows. The run scans and block levels are unaffected.
+class OccupancyGrid {
+public:
+    static constexpr int NUM_LEVELS = 3;
+    static constexpr int LEVEL_SHIFTS[NUM_LEVELS] = {6, 4, 2}; // Coarsest first
+    static constexpr int TILE_SHIFT = 3;
+
+private:
+    struct Level {
+        int width = 0;
+        int height = 0;
+        int rowWords = 0;
+        std::vector<uint64_t> occupied; // 1 bit per block, row-major
+    };
+    
+    int width_;
+    int height_;
+    int rowWords_;
+    int colWords_;
+    int tileWords_; // Tiles per row of tiles
+    CellLayout layout_;
+    std::vector<uint64_t> rows_;
+    std::vector<uint64_t> cols_;
+    std::vector<uint64_t> tiles_; // Empty unless layout_ is TILED
+    Level levels_[NUM_LEVELS];
+    int emptyBlocks_; // Empty blocks at the finest level
+
+public:
+    OccupancyGrid()
+        : width_(0), height_(0), rowWords_(0), colWords_(0), tileWords_(0), layout_(CellLayout::ROW_MAJOR),
+          emptyBlocks_(0) {}
+    explicit OccupancyGrid(const MapView& map, CellLayout layout = CellLayout::ROW_MAJOR) : OccupancyGrid() {
+        layout_ = layout;
+        build(map);
+    }
+    
+    // Switches layout, converting the current contents; later builds keep it
+    void setLayout(CellLayout layout);
+    CellLayout layout() const { return layout_; }
+
+    void build(const MapView& map);
+    // Builds from the wall cells listed in runs, sorted or not
+    void build(int width, int height, const CellRun* runs, size_t numRuns);
+    // Builds from one bit per cell, LSB first, each row starting on a byte boundary
+    void buildFromBitset(int width, int height, const uint8_t* bits);
+    // Builds from one byte per cell, row-major, where 1 is a wall
+    void buildFromBytes(int width, int height, const uint8_t* cells);
+    
+    // Updates one in-bounds cell, and the blocks containing it at each level
+    void setCell(int x, int y, bool wall);
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    size_t memoryBytes() const;
+
+    // Raw row-major words, for kernels that test bits directly
+    const uint64_t* rowData() const { return rows_.data(); }
+    int rowWords() const { return rowWords_; }
+    // Raw tile words with the TILED layout: cell (x, y) is bit tileBit(x, y) of word tileIndex(x, y)
+    const uint64_t* tileData() const { return tiles_.data(); }
+    int tileWords() const { return tileWords_; }
+    size_t tileIndex(int x, int y) const {
+        return static_cast<size_t>(y >> TILE_SHIFT) * tileWords_ + (x >> TILE_SHIFT);
+    }
+    static int tileBit(int x, int y) { return ((y & 7) << TILE_SHIFT) | (x & 7); }
+
+    bool inBounds(int x, int y) const {
+        return x >= 0 && x < width_ && y >= 0 && y < height_;
+    }
+
+    // Out-of-bounds cells are treated as solid
+    bool isWall(int x, int y) const {
+        if (!inBounds(x, y)) return true;
+        if (layout_ == CellLayout::TILED) {
+            return (tiles_[tileIndex(x, y)] >> tileBit(x, y)) & 1;
+        }
+        return (rows_[static_cast<size_t>(y) * rowWords_ + (x >> 6)] >> (x & 63)) & 1;
+    }
+
+    // Number of consecutive empty cells after (x, y) moving along X (step = +1/-1) or Y.
+    // (x, y) must be in bounds.
+    int emptyRunX(int x, int y, int step) const;
+    int emptyRunY(int x, int y, int step) const;
+    
+    // Index of the coarsest level whose block around in-bounds cell (x, y) is empty, or -1
+    int coarsestEmptyLevel(int x, int y) const {
+        for (int level = 0; level < NUM_LEVELS; level++) {
+            if (!levelBit(levels_[level], x >> LEVEL_SHIFTS[level], y >> LEVEL_SHIFTS[level])) {
+                return level;
+            }
+        }
+        return -1;
+    }
+    
+    // Share of the map covered by empty blocks at the finest level
+    double emptyFraction() const {
+        const Level& finest = levels_[NUM_LEVELS - 1];
+        int totalBlocks = finest.width * finest.height;
+        return totalBlocks > 0 ? static_cast<double>(emptyBlocks_) / totalBlocks : 0.0;
+    }
+
+private:
+    void reset(int width, int height);
+    void buildDerived();
+    void buildTiles();
+    void buildLevel(int level);
+    bool blockOccupied(int level, int bx, int by) const;
+    static bool levelBit(const Level& level, int bx, int by) {
+        return (level.occupied[static_cast<size_t>(by) * level.rowWords + (bx >> 6)] >> (bx & 63)) & 1;
+    }
+    static void setRowBits(uint64_t* row, int x, int count);
+    static int scanForward(const uint64_t* words, int numWords, int start, int limit);
+    static int scanBackward(const uint64_t* words, int start);
+};
+
+} // namespace RaycastWorker
@@ -0,0 +1,108 @@
+// packages/worker/include/precision_policy.h
+#pragma once
+#include <cmath>
+#include <cstdint>
+
+namespace RaycastWorker {
+
+// Arithmetic used by the DDA kernel. A policy supplies the scalar type for ray
+// directions and distances plus the few operations the kernel performs on it, and the
+// sine and cosine the camera, column directions and pitch are built from.
+
+struct DoublePrecision {
+    using Scalar = double;
+    static double sine(double angle) { return std::sin(angle); }
+    static double cosine(double angle) { return std::cos(angle); }
+    static Scalar fromDouble(double value) { return value; }
+    static double toDouble(Scalar value) { return value; }
+    static Scalar deltaDist(Scalar dir) { return (dir == 0) ? 1e30 : std::abs(1.0 / dir); }
+    static Scalar mul(Scalar a, Scalar b) { return a * b; }
+};
+
+// Half the width of double, so twice as many lanes per SIMD register
+struct FloatPrecision {
+    using Scalar = float;
+    static double sine(double angle) { return std::sin(angle); }
+    static double cosine(double angle) { return std::cos(angle); }
+    static Scalar fromDouble(double value) { return static_cast<float>(value); }
+    static double toDouble(Scalar value) { return value; }
+    static Scalar deltaDist(Scalar dir) { return (dir == 0) ? 1e30f : std::abs(1.0f / dir); }
+    static Scalar mul(Scalar a, Scalar b) { return a * b; }
+};
+
+// 16.16 fixed point, held in 64 bits so distances can accumulate across large maps.
+// Stepping is integer-only, and so is the trig: angles are rounded to 16.16 and their
+// sine and cosine computed by CORDIC rather than libm, whose results differ between
+// builds and CPUs. The products and sums the kernel forms from them are exact in double,
+// so every worker produces bit-identical results.
+struct FixedPoint16 {
+    using Scalar = int64_t;
+    static constexpr int FRACTION_BITS = 16;
+    static constexpr Scalar ONE = Scalar(1) << FRACTION_BITS;
+    static constexpr Scalar INFINITE_DELTA = Scalar(1) << 40;
+    
+    static Scalar fromDouble(double value) { return static_cast<Scalar>(std::llround(value * ONE)); }
+    static double toDouble(Scalar value) { return static_cast<double>(value) / ONE; }
+    static Scalar deltaDist(Scalar dir) {
+        return (dir == 0) ? INFINITE_DELTA : (ONE * ONE) / (dir < 0 ? -dir : dir);
+    }
+    static Scalar mul(Scalar a, Scalar b) { return (a * b) >> FRACTION_BITS; }
+    
+    // Sine and cosine of a 16.16 angle in radians, within half a unit of the last place.
+    // CORDIC rotation in 2.30 fixed point; angles must stay under 2^32 radians.
+    static void sinCos(Scalar angle, Scalar& sine, Scalar& cosine) {
+        static constexpr int ITERATIONS = 30;
+        static constexpr int64_t ATAN[ITERATIONS] = { // atan(2^-i) in 2.30
+            843314857, 497837829, 263043837, 133525159, 67021687, 33543516, 16775851, 8388437,
+            4194283, 2097149, 1048576, 524288, 262144, 131072, 65536, 32768, 16384, 8192, 4096,
+            2048, 1024, 512, 256, 128, 64, 32, 16, 8, 4, 2
+        };
+        static constexpr int64_t GAIN = 652032874; // Product of cos(atan(2^-i)), in 2.30
+        static constexpr int64_t PI = 3373259426;
+        static constexpr int64_t TWO_PI = 6746518852;
+        static constexpr int64_t HALF_PI = 1686629713;
+        
+        // Into -pi/2..pi/2, rotating by pi when outside it
+        int64_t a = (angle * (int64_t(1) << (30 - FRACTION_BITS))) % TWO_PI;
+        if (a > PI) a -= TWO_PI;
+        if (a < -PI) a += TWO_PI;
+        bool flip = a > HALF_PI || a < -HALF_PI;
+        if (a > HALF_PI) a -= PI;
+        if (a < -HALF_PI) a += PI;
+        
+        int64_t x = GAIN, y = 0;
+        for (int i = 0; i < ITERATIONS; i++) {
+            int64_t dx = y >> i, dy = x >> i;
+            if (a >= 0) {
+                x -= dx;
+                y += dy;
+                a -= ATAN[i];
+            } else {
+                x += dx;
+                y -= dy;
+                a += ATAN[i];
+            }
+        }
+        if (flip) {
+            x = -x;
+            y = -y;
+        }
+        
+        constexpr int SHIFT = 30 - FRACTION_BITS;
+        sine = (y + (int64_t(1) << (SHIFT - 1))) >> SHIFT;
+        cosine = (x + (int64_t(1) << (SHIFT - 1))) >> SHIFT;
+    }
+    
+    static double sine(double angle) {
+        Scalar s, c;
+        sinCos(fromDouble(angle), s, c);
+        return toDouble(s);
+    }
+    static double cosine(double angle) {
+        Scalar s, c;
+        sinCos(fromDouble(angle), s, c);
+        return toDouble(c);
+    }
+};
+
+} // namespace RaycastWorker
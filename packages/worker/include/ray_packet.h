@@ -0,0 +1,53 @@
+// packages/worker/include/ray_packet.h
+#pragma once
+#include "raycast_engine.h"
+
+namespace RaycastWorker {
+
+// Lockstep DDA over a packet of adjacent rays. Each lane runs the same step sequence
+// as RaycastEngine::traverse and is masked off once it hits, so results are identical
+// to the scalar path. Lane count depends on the precision and on the instruction set
+// the worker is built for; precisions without a SIMD kernel use one ray per packet.
+template <typename Precision>
+class RayPacket {
+public:
+    static constexpr int WIDTH = 1;
+
+    static void traverse(RayState<Precision>* rays, int count, const OccupancyGrid& grid) {
+        for (int i = 0; i < count; i++) {
+            RaycastEngine::traverse(rays[i], grid);
+        }
+    }
+};
+
+template <>
+class RayPacket<DoublePrecision> {
+public:
+#if defined(__AVX2__)
+    static constexpr int WIDTH = 4;
+#elif defined(__SSE2__)
+    static constexpr int WIDTH = 2;
+#else
+    static constexpr int WIDTH = 1;
+#endif
+
+    // Traverses rays[0..count), count <= WIDTH
+    static void traverse(RayState<DoublePrecision>* rays, int count, const OccupancyGrid& grid);
+};
+
+template <>
+class RayPacket<FloatPrecision> {
+public:
+#if defined(__AVX2__)
+    static constexpr int WIDTH = 8;
+#elif defined(__SSE2__)
+    static constexpr int WIDTH = 4;
+#else
+    static constexpr int WIDTH = 1;
+#endif
+
+    // Traverses rays[0..count), count <= WIDTH
+    static void traverse(RayState<FloatPrecision>* rays, int count, const OccupancyGrid& grid);
+};
+
+} // namespace RaycastWorker
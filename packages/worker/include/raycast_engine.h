@@ -1,27 +1,119 @@
 // packages/worker/include/raycast_engine.h
 #pragma once
 #include "worker_types.h"
+#include "occupancy_grid.h"
+#include "thread_pool.h"
+#include "direction_table.h"
+#include "precision_policy.h"
 #include <cmath>
 
 namespace RaycastWorker {
 
+// DDA traversal state for a single ray. Side distances are always derived as
+// origin + steps * delta rather than accumulated, so any number of steps along an
+// axis can be taken at once and still land on exactly the value single steps give.
+template <typename Precision = DoublePrecision>
+struct RayState {
+    using Scalar = typename Precision::Scalar;
+    Scalar rayDirX, rayDirY;
+    Scalar deltaDistX, deltaDistY;
+    Scalar sideOriginX, sideOriginY;
+    Scalar sideDistX, sideDistY;
+    int stepsX, stepsY;
+    int mapX, mapY;
+    int stepX, stepY;
+    int side;
+    
+    Scalar sideDistAtX(int steps) const { return sideOriginX + static_cast<Scalar>(steps) * deltaDistX; }
+    Scalar sideDistAtY(int steps) const { return sideOriginY + static_cast<Scalar>(steps) * deltaDistY; }
+    
+    void advanceX(int count = 1) {
+        stepsX += count;
+        mapX += count * stepX;
+        sideDistX = sideDistAtX(stepsX);
+        side = 0;
+    }
+    
+    void advanceY(int count = 1) {
+        stepsY += count;
+        mapY += count * stepY;
+        sideDistY = sideDistAtY(stepsY);
+        side = 1;
+    }
+    
+    // One DDA step along whichever axis boundary is nearer
+    void advance() {
+        if (sideDistX < sideDistY) {
+            advanceX();
+        } else {
+            advanceY();
+        }
+    }
+};
+
 class RaycastEngine {
 private:
     static constexpr double MAX_DISTANCE = 800.0;
     static constexpr int SCREEN_HEIGHT = 768;
+    // Maps with at least this share of empty 4x4 blocks use the block-skipping scalar traversal
+    static constexpr double OPEN_MAP_EMPTY_FRACTION = 0.5;
     
 public:
+    template <typename Precision = DoublePrecision>
+    static RayState<Precision> initRay(double rayDirX, double rayDirY, double playerX, double playerY);
+    template <typename Precision = DoublePrecision>
+    static void traverse(RayState<Precision>& ray, const OccupancyGrid& grid);
+    static void traverse(RayState<>& ray, const MapView& map);
+    template <typename Precision = DoublePrecision>
+    static void finishRay(const RayState<Precision>& ray, double playerX, double playerY, double playerPitch,
+                          double& distance, int& wallType, double& wallX);
+    
+    static void castRay(double rayAngle, double playerX, double playerY, double playerPitch,
+                       const MapView& map, double& distance, int& wallType, double& wallX);
     static void castRay(double rayAngle, double playerX, double playerY, double playerPitch,
-                       const std::vector<std::vector<int>>& map, int mapWidth, int mapHeight,
+                       const OccupancyGrid& grid, double& distance, int& wallType, double& wallX);
+    // Only tests the walls the visible set lists for the player's cell
+    static void castRay(double rayAngle, double playerX, double playerY, double playerPitch,
+                       const OccupancyGrid& grid, const VisibilitySet& visibility,
                        double& distance, int& wallType, double& wallX);
     
-    static std::vector<InternalRaycastResult> renderColumns(const InternalRenderRequest& request);
+    // Splits the column range across pool in chunks of at least minChunkColumns when a pool is given
+    static std::vector<InternalRaycastResult> renderColumns(const InternalRenderRequest& request,
+                                                            ThreadPool* pool = nullptr,
+                                                            int minChunkColumns = 0);
+    // Same, into results, reusing its capacity so repeated frames do not allocate
+    static void renderColumns(const InternalRenderRequest& request, ThreadPool* pool, int minChunkColumns,
+                              std::vector<InternalRaycastResult>& results);
     
-    static bool isWall(double x, double y, const std::vector<std::vector<int>>& map,
-                      int mapWidth, int mapHeight);
+    static bool isWall(double x, double y, const MapView& map);
+    static bool isWall(double x, double y, const OccupancyGrid& grid);
     
     static uint8_t calculateIntensity(double distance);
     static void getWallColor(int wallType, uint8_t intensity, uint8_t& r, uint8_t& g, uint8_t& b);
+    
+private:
+    // Camera-plane ray setup for one frame
+    struct Camera {
+        double dirX, dirY;
+        double planeX, planeY;
+        std::shared_ptr<const DirectionTable> table;
+    };
+    
+    // Camera for the request's player, with its trig and column offsets from Precision
+    template <typename Precision>
+    static Camera makeCamera(const InternalRenderRequest& request);
+    
+    // Grid holding only the walls visible from the player's cell, or grid itself when there is no set
+    static const OccupancyGrid& visibleGrid(const OccupancyGrid& grid, const VisibilitySet* visibility,
+                                            double playerX, double playerY);
+    
+    template <typename Precision>
+    static void skipBlock(RayState<Precision>& ray, int shift);
+    
+    template <typename Precision>
+    static void renderRange(const InternalRenderRequest& request, const Camera& camera,
+                            const OccupancyGrid& grid, int startColumn, int endColumn,
+                            InternalRaycastResult* out);
 };
 
-} // namespace RaycastWorker
\ No newline at end of file
+} // namespace RaycastWorker
@@ -0,0 +1,73 @@
+// packages/worker/include/thread_pool.h
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <atomic>
+
+namespace RaycastWorker {
+
+// Persistent work-stealing pool. parallelFor's helper tasks go on per-thread deques: each
+// thread pops its own LIFO and steals from the front of the others' when it runs dry.
+// Tasks from submit, such as whole requests, wait in one shared FIFO queue instead, so they
+// start in arrival order. Threads take them only once no helper task is waiting, finishing
+// work already started before starting more.
+class ThreadPool {
+private:
+    struct TaskQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+    
+    // Chunks of one parallelFor call, shared by the caller and its helpers
+    struct ParallelForState {
+        std::atomic<int> refs{0}; // Threads that may still touch the state
+        std::atomic<int> nextChunk{0};
+        int begin = 0, end = 0;
+        int chunkSize = 0, numChunks = 0;
+        const std::function<void(int, int)>* fn = nullptr;
+        int completed = 0;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+    
+    std::vector<std::unique_ptr<TaskQueue>> queues_;
+    TaskQueue submitted_; // FIFO
+    std::vector<std::thread> threads_;
+    std::mutex sleepMutex_;
+    std::condition_variable wake_;
+    std::atomic<int> pending_;
+    std::atomic<size_t> nextQueue_;
+    bool stop_;
+    std::vector<std::unique_ptr<ParallelForState>> states_; // Reused across parallelFor calls
+    std::mutex statesMutex_;
+    
+public:
+    explicit ThreadPool(int numThreads);
+    ~ThreadPool();
+    
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    
+    int size() const { return static_cast<int>(threads_.size()); }
+    
+    // Queues task behind every task submitted before it
+    void submit(std::function<void()> task);
+    
+    // Runs fn(chunkBegin, chunkEnd) over [begin, end) in chunks of at least minChunk items.
+    // The calling thread works on chunks too and returns once all of them are done.
+    void parallelFor(int begin, int end, int minChunk, const std::function<void(int, int)>& fn);
+    
+private:
+    void pushHelper(std::function<void()> task);
+    void workerLoop(int index);
+    bool runOne(int index);
+    static void runChunks(ParallelForState* state);
+    ParallelForState* acquireState(int refs);
+};
+
+} // namespace RaycastWorker
@@ -0,0 +1,66 @@
+// packages/worker/include/visibility_set.h
+#pragma once
+#include "occupancy_grid.h"
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace RaycastWorker {
+
+// Potentially visible set (PVS) for a static map: for every empty cell, the wall cells
+// that a ray starting anywhere inside that cell can hit first, stored as run-length
+// encoded ranges of row-major cell indices.
+//
+// The sets are conservative: a wall left out is one that no such ray reaches, so a grid
+// holding only a cell's visible walls gives the same hits as the full map from inside it.
+// Building costs roughly cells * beams * view depth, so it is meant to run once per map.
+class VisibilitySet {
+public:
+    // Beams per octant; more beams give tighter sets at a proportional build cost
+    static constexpr int DEFAULT_BEAMS_PER_OCTANT = 32;
+    // Maps larger than this are not precomputed
+    static constexpr int DEFAULT_MAX_CELLS = 128 * 128;
+
+private:
+    int width_;
+    int height_;
+    uint64_t id_; // Distinguishes sets in caches keyed by the set rather than its address
+    std::vector<uint32_t> offsets_; // Per cell, index of its first run; size width * height + 1
+    std::vector<CellRun> runs_;
+
+public:
+    VisibilitySet() : width_(0), height_(0), id_(0) {}
+
+    // Returns false, leaving the set empty, if the map has more than maxCells cells
+    bool build(const OccupancyGrid& grid, int beamsPerOctant = DEFAULT_BEAMS_PER_OCTANT,
+               int maxCells = DEFAULT_MAX_CELLS);
+
+    bool empty() const { return runs_.empty(); }
+    int width() const { return width_; }
+    int height() const { return height_; }
+    uint64_t id() const { return id_; }
+    size_t memoryBytes() const;
+
+    // Whether (x, y) is an in-bounds empty cell with a computed set
+    bool hasCell(int x, int y) const {
+        if (x < 0 || x >= width_ || y < 0 || y >= height_) return false;
+        size_t cell = static_cast<size_t>(y) * width_ + x;
+        return offsets_[cell] != offsets_[cell + 1];
+    }
+
+    const CellRun* runsBegin(int x, int y) const { return runs_.data() + offsets_[cellIndex(x, y)]; }
+    const CellRun* runsEnd(int x, int y) const { return runs_.data() + offsets_[cellIndex(x, y) + 1]; }
+    size_t visibleCount(int x, int y) const;
+
+    bool isVisible(int fromX, int fromY, int wallX, int wallY) const;
+
+    // Fills out with only the walls visible from cell (x, y), which must have a set
+    void decode(int x, int y, OccupancyGrid& out) const;
+
+private:
+    size_t cellIndex(int x, int y) const { return static_cast<size_t>(y) * width_ + x; }
+    void castBeams(const OccupancyGrid& grid, int cellX, int cellY, int beamsPerOctant,
+                   std::vector<uint64_t>& visible) const;
+};
+
+} // namespace RaycastWorker
@@ -5,9 +5,28 @@
 #include <cstdint>
 #include <chrono>
 #include <atomic>
+#include "map_view.h"
 
 namespace RaycastWorker {
 
+class OccupancyGrid;
+class VisibilitySet;
+
+// Arithmetic used by the raycast kernel for a request
+enum class RenderPrecision {
+    DOUBLE,
+    FLOAT,
+    FIXED_16_16
+};
+
+// Order of the wall bits that traversal tests cell by cell. TILED packs each 8x8 block of cells
+// into one 64-bit word, so rays running along Y reach a new cache line every 8 rows instead of
+// every row.
+enum class CellLayout {
+    ROW_MAJOR,
+    TILED
+};
+
 struct InternalPlayer {
     double x, y;
     double angle;
@@ -24,6 +43,7 @@ struct InternalRaycastResult {
     int wallTop;
     int wallBottom;
     uint8_t r, g, b; // Color for this column
+    int steps; // DDA steps the ray took, a measure of what the column cost
 };
 
 struct InternalRenderRequest {
@@ -35,9 +55,11 @@ struct InternalRenderRequest {
     double fov;
     int startColumn;
     int endColumn;
-    std::vector<std::vector<int>> map;
-    int mapWidth;
-    int mapHeight;
+    MapView map;
+    const OccupancyGrid* occupancy = nullptr; // Prebuilt wall bits for map, if available
+    const VisibilitySet* visibility = nullptr; // Precomputed visible walls per cell, if available
+    RenderPrecision precision = RenderPrecision::DOUBLE;
+    CellLayout layout = CellLayout::ROW_MAJOR; // For wall bits built from map
     uint64_t timestamp;
 };
 
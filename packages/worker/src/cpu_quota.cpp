@@ -0,0 +1,52 @@
+// packages/worker/src/cpu_quota.cpp
+#include "cpu_quota.h"
+#include <sched.h>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <string>
+#include <thread>
+
+namespace RaycastWorker {
+
+namespace {
+    // Quota / period in CPUs, or 0 when the cgroup sets no limit
+    double cgroupCpuLimit() {
+        // cgroup v2: "<quota> <period>", or "max <period>" when unlimited
+        std::ifstream cpuMax("/sys/fs/cgroup/cpu.max");
+        std::string quota;
+        double period = 0;
+        if (cpuMax >> quota >> period) {
+            return quota == "max" || period <= 0 ? 0.0 : std::stod(quota) / period;
+        }
+        
+        // cgroup v1: quota is -1 when unlimited
+        std::ifstream quotaFile("/sys/fs/cgroup/cpu/cpu.cfs_quota_us");
+        std::ifstream periodFile("/sys/fs/cgroup/cpu/cpu.cfs_period_us");
+        double quotaUs = 0, periodUs = 0;
+        if (quotaFile >> quotaUs && periodFile >> periodUs && quotaUs > 0 && periodUs > 0) {
+            return quotaUs / periodUs;
+        }
+        return 0.0;
+    }
+}
+
+int availableCpuCount() {
+    int cpus = static_cast<int>(std::thread::hardware_concurrency());
+    
+    cpu_set_t affinity;
+    CPU_ZERO(&affinity);
+    if (sched_getaffinity(0, sizeof(affinity), &affinity) == 0) {
+        int allowed = CPU_COUNT(&affinity);
+        cpus = cpus > 0 ? std::min(cpus, allowed) : allowed;
+    }
+    
+    double limit = cgroupCpuLimit();
+    if (limit > 0) {
+        int quotaCpus = static_cast<int>(std::ceil(limit));
+        cpus = cpus > 0 ? std::min(cpus, quotaCpus) : quotaCpus;
+    }
+    return std::max(cpus, 1);
+}
+
+} // namespace RaycastWorker
@@ -0,0 +1,73 @@
+// packages/worker/src/direction_table.cpp
+#include "direction_table.h"
+#include "precision_policy.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+namespace RaycastWorker {
+
+namespace {
+    constexpr size_t MAX_CACHED_TABLES = 16;
+    
+    uint64_t makeKey(int screenWidth, double fov, bool fixedPoint) {
+        uint64_t fovBits;
+        std::memcpy(&fovBits, &fov, sizeof(fovBits));
+        return (fovBits * 0x9E3779B97F4A7C15ull) ^ static_cast<uint32_t>(screenWidth) ^
+               (static_cast<uint64_t>(fixedPoint) << 32);
+    }
+    
+    std::mutex g_cacheMutex;
+    std::unordered_map<uint64_t, std::shared_ptr<const DirectionTable>> g_cache;
+    
+    // Most threads render one resolution over and over, so skip the shared lookup for it
+    thread_local std::shared_ptr<const DirectionTable> t_lastTable;
+}
+
+DirectionTable::DirectionTable(int screenWidth, double fov, bool fixedPoint)
+    : screenWidth_(screenWidth), fov_(fov), fixedPoint_(fixedPoint) {
+    int columns = std::max(screenWidth, 0);
+    cosOffset_.resize(columns);
+    sinOffset_.resize(columns);
+    
+    for (int x = 0; x < columns; x++) {
+        double offset = -fov / 2 + (x * fov / screenWidth);
+        cosOffset_[x] = fixedPoint ? FixedPoint16::cosine(offset) : cos(offset);
+        sinOffset_[x] = fixedPoint ? FixedPoint16::sine(offset) : sin(offset);
+    }
+}
+
+std::shared_ptr<const DirectionTable> DirectionTable::get(int screenWidth, double fov, bool fixedPoint) {
+    auto matches = [&](const DirectionTable& table) {
+        return table.screenWidth() == screenWidth && table.fov() == fov && table.fixedPoint() == fixedPoint;
+    };
+    if (t_lastTable && matches(*t_lastTable)) {
+        return t_lastTable;
+    }
+    
+    uint64_t key = makeKey(screenWidth, fov, fixedPoint);
+    std::shared_ptr<const DirectionTable> table;
+    {
+        std::lock_guard<std::mutex> lock(g_cacheMutex);
+        auto it = g_cache.find(key);
+        if (it != g_cache.end() && matches(*it->second)) {
+            table = it->second;
+        }
+    }
+    
+    if (!table) {
+        table = std::make_shared<const DirectionTable>(screenWidth, fov, fixedPoint);
+        std::lock_guard<std::mutex> lock(g_cacheMutex);
+        if (g_cache.size() >= MAX_CACHED_TABLES) {
+            g_cache.erase(g_cache.begin());
+        }
+        g_cache[key] = table;
+    }
+    
+    t_lastTable = table;
+    return table;
+}
+
+} // namespace RaycastWorker
@@ -0,0 +1,205 @@
+// packages/worker/src/map_cache.cpp
+#include "map_cache.h"
+#include "MapHash.h"
+
+namespace RaycastWorker {
+
+size_t CachedMap::memoryBytes() const {
+    auto set = visibleSet();
+    return cells.size() * sizeof(int32_t) + grid.memoryBytes() + (set ? set->memoryBytes() : 0);
+}
+
+void CachedMap::setCell(int x, int y, int32_t value) {
+    cells[static_cast<size_t>(y) * width + x] = value;
+    grid.setCell(x, y, value == 1);
+}
+
+MapCache::MapCache(size_t capacityBytes, CellLayout layout)
+    : capacityBytes_(capacityBytes), layout_(layout), usedBytes_(0), hits_(0), misses_(0), evictions_(0), closing_(false),
+      visibilityBuilder_(1) {}
+
+// Builds still queued are skipped rather than holding up shutdown
+MapCache::~MapCache() {
+    closing_ = true;
+}
+
+std::shared_ptr<const CachedMap> MapCache::find(const std::string& id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(id);
+    if (it == index_.end()) {
+        misses_++;
+        return nullptr;
+    }
+    hits_++;
+    touch(it->second);
+    return *it->second;
+}
+
+MapCache::Entry MapCache::lookup(const std::string& id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(id);
+    return it != index_.end() ? *it->second : nullptr;
+}
+
+std::shared_ptr<const CachedMap> MapCache::insert(const std::string& id, uint64_t contentHash,
+                                                  std::vector<int32_t> cells, int width, int height,
+                                                  uint64_t version) {
+    // Only the uploader knows which version is current, so the cached version follows it
+    if (Entry cached = lookup(id)) {
+        std::unique_lock<std::shared_mutex> mapLock(cached->mutex);
+        if (cached->contentHash == contentHash) {
+            cached->version = version;
+            return cached;
+        }
+    }
+
+    // The occupancy bits take a few milliseconds even for large maps, so build them unlocked
+    auto map = std::make_shared<CachedMap>();
+    map->id = id;
+    map->version = version;
+    map->contentHash = contentHash;
+    map->width = width;
+    map->height = height;
+    map->cells = std::move(cells);
+    map->grid.setLayout(layout_);
+    map->grid.build(map->view());
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        store(map);
+    }
+    // Renders use the occupancy bits alone until the visible sets are published
+    queueVisibility(map);
+    return map;
+}
+
+void MapCache::queueVisibility(const Entry& map) {
+    if (map->visibilityQueued.exchange(true)) {
+        return; // The queued build will see the latest cells
+    }
+    std::weak_ptr<CachedMap> pending = map;
+    visibilityBuilder_.submit([this, pending] { buildVisibility(pending); });
+}
+
+void MapCache::buildVisibility(std::weak_ptr<CachedMap> pending) {
+    Entry map = pending.lock();
+    if (!map || closing_) {
+        return; // Evicted or replaced before its turn came
+    }
+    map->visibilityQueued = false;
+
+    // Build from a copy of the occupancy bits, so deltas are not held up meanwhile
+    OccupancyGrid grid;
+    uint64_t contentHash;
+    {
+        std::shared_lock<std::shared_mutex> mapLock(map->mutex);
+        grid = map->grid;
+        contentHash = map->contentHash;
+    }
+    auto visibility = std::make_shared<VisibilitySet>();
+    if (!visibility->build(grid)) {
+        return; // Too large to precompute
+    }
+
+    std::unique_lock<std::shared_mutex> mapLock(map->mutex);
+    if (map->contentHash != contentHash) {
+        return; // A delta landed meanwhile and queued its own build
+    }
+    std::atomic_store(&map->visibility, std::shared_ptr<const VisibilitySet>(std::move(visibility)));
+    std::lock_guard<std::mutex> lock(mutex_);
+    recount(map.get());
+}
+
+MapCache::DeltaResult MapCache::applyDelta(const std::string& id, uint64_t baseVersion, uint64_t newVersion,
+                                           const std::vector<MapCellChange>& changes,
+                                           uint64_t& currentVersion) {
+    if (newVersion <= baseVersion) {
+        return DeltaResult::INVALID_VERSION;
+    }
+    Entry map = lookup(id);
+    if (!map) {
+        return DeltaResult::NOT_FOUND;
+    }
+
+    // The map's mutex serializes deltas, so each applies to the version it names
+    {
+        std::unique_lock<std::shared_mutex> mapLock(map->mutex);
+        currentVersion = map->version;
+        if (map->version != baseVersion) {
+            return DeltaResult::STALE_VERSION;
+        }
+        for (const MapCellChange& change : changes) {
+            if (change.x < 0 || change.x >= map->width || change.y < 0 || change.y >= map->height) {
+                return DeltaResult::OUT_OF_BOUNDS;
+            }
+        }
+
+        // Only the blocks around changed cells are recomputed. Visibility is not local to the
+        // changed cells, so the visible sets are dropped and rebuilt in the background.
+        for (const MapCellChange& change : changes) {
+            size_t index = static_cast<size_t>(change.y) * map->width + change.x;
+            map->contentHash = updateMapHash(map->contentHash, index, map->cells[index], change.value);
+            map->setCell(change.x, change.y, change.value);
+        }
+        map->version = newVersion;
+        std::atomic_store(&map->visibility, std::shared_ptr<const VisibilitySet>());
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        recount(map.get());
+    }
+    queueVisibility(map);
+    currentVersion = newVersion;
+    return DeltaResult::APPLIED;
+}
+
+size_t MapCache::usedBytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return usedBytes_;
+}
+
+size_t MapCache::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lru_.size();
+}
+
+void MapCache::touch(std::list<Entry>::iterator it) {
+    lru_.splice(lru_.begin(), lru_, it);
+}
+
+void MapCache::store(Entry map) {
+    auto it = index_.find(map->id);
+    if (it != index_.end()) {
+        usedBytes_ -= (*it->second)->accountedBytes;
+        lru_.erase(it->second);
+    }
+    map->accountedBytes = map->memoryBytes();
+    usedBytes_ += map->accountedBytes;
+    lru_.push_front(std::move(map));
+    index_[lru_.front()->id] = lru_.begin();
+    evict();
+}
+
+// Counts a cached map's current size against the budget; maps no longer cached do not count
+void MapCache::recount(CachedMap* map) {
+    auto it = index_.find(map->id);
+    if (it == index_.end() || it->second->get() != map) {
+        return;
+    }
+    size_t bytes = map->memoryBytes();
+    usedBytes_ = usedBytes_ - map->accountedBytes + bytes;
+    map->accountedBytes = bytes;
+    evict();
+}
+
+// Evicts from the cold end, but always keeps the most recent map
+void MapCache::evict() {
+    while (usedBytes_ > capacityBytes_ && lru_.size() > 1) {
+        const Entry& victim = lru_.back();
+        usedBytes_ -= victim->accountedBytes;
+        index_.erase(victim->id);
+        lru_.pop_back();
+        evictions_++;
+    }
+}
+
+} // namespace RaycastWorker
@@ -0,0 +1,280 @@
+// packages/worker/src/occupancy_grid.cpp
+#include "occupancy_grid.h"
+#include <algorithm>
+
+namespace RaycastWorker {
+
+void OccupancyGrid::build(const MapView& map) {
+    reset(map.width(), map.height());
+    for (int y = 0; y < height_; y++) {
+        uint64_t* row = &rows_[static_cast<size_t>(y) * rowWords_];
+        for (int x = 0; x < width_; x++) {
+            if (map.at(x, y) == 1) {
+                row[x >> 6] |= uint64_t(1) << (x & 63);
+            }
+        }
+    }
+    buildDerived();
+}
+
+void OccupancyGrid::build(int width, int height, const CellRun* runs, size_t numRuns) {
+    reset(width, height);
+    for (size_t i = 0; i < numRuns; i++) {
+        // Runs are row-major, so split them at row ends
+        uint32_t cell = runs[i].start;
+        uint32_t end = runs[i].start + runs[i].length;
+        while (cell < end) {
+            int y = static_cast<int>(cell / width_);
+            int x = static_cast<int>(cell % width_);
+            int count = static_cast<int>(std::min<uint32_t>(end - cell, width_ - x));
+            setRowBits(&rows_[static_cast<size_t>(y) * rowWords_], x, count);
+            cell += count;
+        }
+    }
+    buildDerived();
+}
+
+void OccupancyGrid::buildFromBitset(int width, int height, const uint8_t* bits) {
+    reset(width, height);
+    size_t rowBytes = (static_cast<size_t>(width) + 7) / 8;
+    for (int y = 0; y < height_; y++) {
+        const uint8_t* src = bits + y * rowBytes;
+        uint64_t* row = &rows_[static_cast<size_t>(y) * rowWords_];
+        for (size_t i = 0; i < rowBytes; i++) {
+            row[i >> 3] |= static_cast<uint64_t>(src[i]) << ((i & 7) * 8);
+        }
+        // Clear padding bits so buildDerived sees no walls past the edge
+        if (width_ & 63) {
+            row[rowWords_ - 1] &= ~(~uint64_t(0) << (width_ & 63));
+        }
+    }
+    buildDerived();
+}
+
+void OccupancyGrid::buildFromBytes(int width, int height, const uint8_t* cells) {
+    reset(width, height);
+    for (int y = 0; y < height_; y++) {
+        const uint8_t* src = cells + static_cast<size_t>(y) * width_;
+        uint64_t* row = &rows_[static_cast<size_t>(y) * rowWords_];
+        for (int x = 0; x < width_; x++) {
+            row[x >> 6] |= static_cast<uint64_t>(src[x] == 1) << (x & 63);
+        }
+    }
+    buildDerived();
+}
+
+void OccupancyGrid::reset(int width, int height) {
+    width_ = width;
+    height_ = height;
+    rowWords_ = (width_ + 63) / 64;
+    colWords_ = (height_ + 63) / 64;
+    rows_.assign(static_cast<size_t>(height_) * rowWords_, 0);
+    cols_.assign(static_cast<size_t>(width_) * colWords_, 0);
+    tileWords_ = 0;
+    tiles_.clear();
+}
+
+void OccupancyGrid::setLayout(CellLayout layout) {
+    if (layout == layout_) {
+        return;
+    }
+    layout_ = layout;
+    tileWords_ = 0;
+    tiles_.clear();
+    tiles_.shrink_to_fit();
+    buildTiles();
+}
+
+void OccupancyGrid::setRowBits(uint64_t* row, int x, int count) {
+    while (count > 0) {
+        int bit = x & 63;
+        int n = std::min(count, 64 - bit);
+        uint64_t mask = n == 64 ? ~uint64_t(0) : ((uint64_t(1) << n) - 1) << bit;
+        row[x >> 6] |= mask;
+        x += n;
+        count -= n;
+    }
+}
+
+// Fills the column and tile planes, padding and block levels from the row plane
+void OccupancyGrid::buildDerived() {
+    for (int y = 0; y < height_; y++) {
+        const uint64_t* row = &rows_[static_cast<size_t>(y) * rowWords_];
+        for (int w = 0; w < rowWords_; w++) {
+            for (uint64_t bits = row[w]; bits; bits &= bits - 1) {
+                int x = (w << 6) + __builtin_ctzll(bits);
+                cols_[static_cast<size_t>(x) * colWords_ + (y >> 6)] |= uint64_t(1) << (y & 63);
+            }
+        }
+    }
+    buildTiles();
+
+    // Mark padding past the right and bottom edges as solid
+    if (width_ & 63) {
+        for (int y = 0; y < height_; y++) {
+            rows_[static_cast<size_t>(y) * rowWords_ + rowWords_ - 1] |= ~uint64_t(0) << (width_ & 63);
+        }
+    }
+    if (height_ & 63) {
+        for (int x = 0; x < width_; x++) {
+            cols_[static_cast<size_t>(x) * colWords_ + colWords_ - 1] |= ~uint64_t(0) << (height_ & 63);
+        }
+    }
+    
+    for (int level = 0; level < NUM_LEVELS; level++) {
+        buildLevel(level);
+    }
+    
+    const Level& finest = levels_[NUM_LEVELS - 1];
+    emptyBlocks_ = 0;
+    for (int by = 0; by < finest.height; by++) {
+        for (int bx = 0; bx < finest.width; bx++) {
+            if (!levelBit(finest, bx, by)) {
+                emptyBlocks_++;
+            }
+        }
+    }
+}
+
+// Fills the tile plane from the row plane, ignoring its padding, when the layout uses tiles
+void OccupancyGrid::buildTiles() {
+    if (layout_ != CellLayout::TILED) {
+        return;
+    }
+    tileWords_ = (width_ + 7) >> TILE_SHIFT;
+    tiles_.assign(static_cast<size_t>((height_ + 7) >> TILE_SHIFT) * tileWords_, 0);
+    for (int y = 0; y < height_; y++) {
+        const uint64_t* row = &rows_[static_cast<size_t>(y) * rowWords_];
+        for (int x = 0; x < width_; x += 8) {
+            // Each tile row is one byte of the row plane
+            uint64_t byte = (row[x >> 6] >> (x & 63)) & 0xFF;
+            if (x + 8 > width_) {
+                byte &= (uint64_t(1) << (width_ - x)) - 1;
+            }
+            tiles_[tileIndex(x, y)] |= byte << ((y & 7) << TILE_SHIFT);
+        }
+    }
+}
+
+void OccupancyGrid::buildLevel(int level) {
+    int shift = LEVEL_SHIFTS[level];
+    int size = 1 << shift;
+    
+    Level& l = levels_[level];
+    l.width = (width_ + size - 1) >> shift;
+    l.height = (height_ + size - 1) >> shift;
+    l.rowWords = (l.width + 63) / 64;
+    l.occupied.assign(static_cast<size_t>(l.height) * l.rowWords, 0);
+    
+    for (int by = 0; by < l.height; by++) {
+        uint64_t* out = &l.occupied[static_cast<size_t>(by) * l.rowWords];
+        for (int bx = 0; bx < l.width; bx++) {
+            if (blockOccupied(level, bx, by)) {
+                out[bx >> 6] |= uint64_t(1) << (bx & 63);
+            }
+        }
+    }
+}
+
+// Blocks are aligned and no wider than a word, so each block row is one masked word.
+// Padding bits already mark blocks that run past the right edge.
+bool OccupancyGrid::blockOccupied(int level, int bx, int by) const {
+    int shift = LEVEL_SHIFTS[level];
+    int size = 1 << shift;
+    uint64_t blockMask = size >= 64 ? ~uint64_t(0) : (uint64_t(1) << size) - 1;
+    
+    int x0 = bx << shift;
+    int y0 = by << shift;
+    if (y0 + size > height_) return true;
+    for (int y = y0; y < y0 + size; y++) {
+        uint64_t word = rows_[static_cast<size_t>(y) * rowWords_ + (x0 >> 6)];
+        if ((word >> (x0 & 63)) & blockMask) return true;
+    }
+    return false;
+}
+
+void OccupancyGrid::setCell(int x, int y, bool wall) {
+    uint64_t& rowWord = rows_[static_cast<size_t>(y) * rowWords_ + (x >> 6)];
+    uint64_t& colWord = cols_[static_cast<size_t>(x) * colWords_ + (y >> 6)];
+    uint64_t rowBit = uint64_t(1) << (x & 63);
+    uint64_t colBit = uint64_t(1) << (y & 63);
+    if (wall) {
+        rowWord |= rowBit;
+        colWord |= colBit;
+    } else {
+        rowWord &= ~rowBit;
+        colWord &= ~colBit;
+    }
+    if (layout_ == CellLayout::TILED) {
+        uint64_t& tileWord = tiles_[tileIndex(x, y)];
+        uint64_t tileMask = uint64_t(1) << tileBit(x, y);
+        tileWord = wall ? tileWord | tileMask : tileWord & ~tileMask;
+    }
+    
+    // Only the blocks containing the cell can change
+    for (int level = 0; level < NUM_LEVELS; level++) {
+        Level& l = levels_[level];
+        int bx = x >> LEVEL_SHIFTS[level];
+        int by = y >> LEVEL_SHIFTS[level];
+        bool wasOccupied = levelBit(l, bx, by);
+        bool occupied = blockOccupied(level, bx, by);
+        if (occupied == wasOccupied) continue;
+        
+        l.occupied[static_cast<size_t>(by) * l.rowWords + (bx >> 6)] ^= uint64_t(1) << (bx & 63);
+        if (level == NUM_LEVELS - 1) {
+            emptyBlocks_ += occupied ? -1 : 1;
+        }
+    }
+}
+
+size_t OccupancyGrid::memoryBytes() const {
+    size_t words = rows_.size() + cols_.size() + tiles_.size();
+    for (const Level& level : levels_) {
+        words += level.occupied.size();
+    }
+    return words * sizeof(uint64_t);
+}
+
+int OccupancyGrid::emptyRunX(int x, int y, int step) const {
+    const uint64_t* row = &rows_[static_cast<size_t>(y) * rowWords_];
+    return step > 0 ? scanForward(row, rowWords_, x + 1, width_) : scanBackward(row, x - 1);
+}
+
+int OccupancyGrid::emptyRunY(int x, int y, int step) const {
+    const uint64_t* col = &cols_[static_cast<size_t>(x) * colWords_];
+    return step > 0 ? scanForward(col, colWords_, y + 1, height_) : scanBackward(col, y - 1);
+}
+
+// Count clear bits from `start` upwards, stopping at the first set bit or `limit`
+int OccupancyGrid::scanForward(const uint64_t* words, int numWords, int start, int limit) {
+    if (start >= limit) return 0;
+
+    int w = start >> 6;
+    uint64_t bits = words[w] >> (start & 63);
+    if (bits) return __builtin_ctzll(bits);
+
+    int count = 64 - (start & 63);
+    for (w++; w < numWords; w++) {
+        if (words[w]) return count + __builtin_ctzll(words[w]);
+        count += 64;
+    }
+    return limit - start;
+}
+
+// Count clear bits from `start` downwards to bit 0, stopping at the first set bit
+int OccupancyGrid::scanBackward(const uint64_t* words, int start) {
+    if (start < 0) return 0;
+
+    int w = start >> 6;
+    uint64_t bits = words[w] << (63 - (start & 63));
+    if (bits) return __builtin_clzll(bits);
+
+    int count = (start & 63) + 1;
+    for (w--; w >= 0; w--) {
+        if (words[w]) return count + __builtin_clzll(words[w]);
+        count += 64;
+    }
+    return count;
+}
+
+} // namespace RaycastWorker
@@ -0,0 +1,407 @@
+// packages/worker/src/ray_packet.cpp
+#include "ray_packet.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace RaycastWorker {
+
+namespace {
+    // Scalar tail shared by every kernel: packets smaller than the full width
+    template <typename Precision>
+    void traverseEach(RayState<Precision>* rays, int count, const OccupancyGrid& grid) {
+        for (int i = 0; i < count; i++) {
+            RaycastEngine::traverse(rays[i], grid);
+        }
+    }
+}
+
+#if defined(__AVX2__)
+
+namespace {
+    // Word (64-bit lanes) or 32-bit half word (32-bit lanes) holding each lane's cell, and
+    // the bit within it, in the grid's cell layout. The row-major case is the plain
+    // y * rowWords + x / 64 addressing; tiles put each 8x8 block of cells in one word.
+    template <CellLayout Layout>
+    inline void cellAddress(__m256i mapX, __m256i mapY, __m256i stride, __m256i& index, __m256i& bit) {
+        if (Layout == CellLayout::TILED) {
+            const __m256i vSeven = _mm256_set1_epi64x(7);
+            index = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(mapY, 3), stride), _mm256_srli_epi64(mapX, 3));
+            bit = _mm256_or_si256(_mm256_slli_epi64(_mm256_and_si256(mapY, vSeven), 3), _mm256_and_si256(mapX, vSeven));
+        } else {
+            index = _mm256_add_epi64(_mm256_mul_epu32(mapY, stride), _mm256_srli_epi64(mapX, 6));
+            bit = _mm256_and_si256(mapX, _mm256_set1_epi64x(63));
+        }
+    }
+    
+    template <CellLayout Layout>
+    inline void halfWordAddress(__m256i mapX, __m256i mapY, __m256i stride, __m256i& index, __m256i& bit) {
+        if (Layout == CellLayout::TILED) {
+            // Rows 0-3 of a tile are its low half, rows 4-7 its high half
+            const __m256i vSeven = _mm256_set1_epi32(7);
+            __m256i word = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(mapY, 3), stride),
+                                            _mm256_srli_epi32(mapX, 3));
+            index = _mm256_add_epi32(_mm256_slli_epi32(word, 1), _mm256_srli_epi32(_mm256_and_si256(mapY, vSeven), 2));
+            bit = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(mapY, _mm256_set1_epi32(3)), 3),
+                                  _mm256_and_si256(mapX, vSeven));
+        } else {
+            index = _mm256_add_epi32(_mm256_mullo_epi32(mapY, _mm256_slli_epi32(stride, 1)), _mm256_srli_epi32(mapX, 5));
+            bit = _mm256_and_si256(mapX, _mm256_set1_epi32(31));
+        }
+    }
+
+// Each kernel is instantiated per layout, so the row-major one addresses cells as plainly as before
+template <CellLayout Layout>
+void traverseDoubles(RayState<DoublePrecision>* rays, int count, const OccupancyGrid& grid) {
+    constexpr int WIDTH = RayPacket<DoublePrecision>::WIDTH;
+    alignas(32) double sideX[WIDTH], sideY[WIDTH], deltaX[WIDTH], deltaY[WIDTH];
+    alignas(32) double originX[WIDTH], originY[WIDTH], stepsX[WIDTH], stepsY[WIDTH];
+    alignas(32) int64_t mapX[WIDTH], mapY[WIDTH], stepX[WIDTH], stepY[WIDTH], side[WIDTH], live[WIDTH];
+    
+    for (int i = 0; i < WIDTH; i++) {
+        const RayState<DoublePrecision>& ray = rays[i < count ? i : 0];
+        sideX[i] = ray.sideDistX;
+        sideY[i] = ray.sideDistY;
+        originX[i] = ray.sideOriginX;
+        originY[i] = ray.sideOriginY;
+        stepsX[i] = ray.stepsX;
+        stepsY[i] = ray.stepsY;
+        deltaX[i] = ray.deltaDistX;
+        deltaY[i] = ray.deltaDistY;
+        mapX[i] = ray.mapX;
+        mapY[i] = ray.mapY;
+        stepX[i] = ray.stepX;
+        stepY[i] = ray.stepY;
+        side[i] = ray.side;
+        live[i] = i < count ? -1 : 0;
+    }
+    
+    __m256d vSideX = _mm256_load_pd(sideX);
+    __m256d vSideY = _mm256_load_pd(sideY);
+    const __m256d vDeltaX = _mm256_load_pd(deltaX);
+    const __m256d vDeltaY = _mm256_load_pd(deltaY);
+    const __m256d vOriginX = _mm256_load_pd(originX);
+    const __m256d vOriginY = _mm256_load_pd(originY);
+    __m256d vStepsX = _mm256_load_pd(stepsX);
+    __m256d vStepsY = _mm256_load_pd(stepsY);
+    const __m256d vOneStep = _mm256_set1_pd(1.0);
+    __m256i vMapX = _mm256_load_si256(reinterpret_cast<const __m256i*>(mapX));
+    __m256i vMapY = _mm256_load_si256(reinterpret_cast<const __m256i*>(mapY));
+    const __m256i vStepX = _mm256_load_si256(reinterpret_cast<const __m256i*>(stepX));
+    const __m256i vStepY = _mm256_load_si256(reinterpret_cast<const __m256i*>(stepY));
+    __m256i vSide = _mm256_load_si256(reinterpret_cast<const __m256i*>(side));
+    __m256i vActive = _mm256_load_si256(reinterpret_cast<const __m256i*>(live));
+    
+    const __m256i vZero = _mm256_setzero_si256();
+    const __m256i vOne = _mm256_set1_epi64x(1);
+    const __m256i vMinusOne = _mm256_set1_epi64x(-1);
+    const __m256i vWidth = _mm256_set1_epi64x(grid.width());
+    const __m256i vHeight = _mm256_set1_epi64x(grid.height());
+    const bool tiled = Layout == CellLayout::TILED;
+    const __m256i vStride = _mm256_set1_epi64x(tiled ? grid.tileWords() : grid.rowWords());
+    const long long* words = reinterpret_cast<const long long*>(tiled ? grid.tileData() : grid.rowData());
+    
+    while (!_mm256_testz_si256(vActive, vActive)) {
+        // Step along X where sideDistX < sideDistY, otherwise along Y
+        __m256i takeX = _mm256_castpd_si256(_mm256_cmp_pd(vSideX, vSideY, _CMP_LT_OQ));
+        __m256i moveX = _mm256_and_si256(takeX, vActive);
+        __m256i moveY = _mm256_andnot_si256(takeX, vActive);
+        
+        vStepsX = _mm256_add_pd(vStepsX, _mm256_and_pd(vOneStep, _mm256_castsi256_pd(moveX)));
+        vStepsY = _mm256_add_pd(vStepsY, _mm256_and_pd(vOneStep, _mm256_castsi256_pd(moveY)));
+        vSideX = _mm256_add_pd(vOriginX, _mm256_mul_pd(vStepsX, vDeltaX));
+        vSideY = _mm256_add_pd(vOriginY, _mm256_mul_pd(vStepsY, vDeltaY));
+        vMapX = _mm256_add_epi64(vMapX, _mm256_and_si256(vStepX, moveX));
+        vMapY = _mm256_add_epi64(vMapY, _mm256_and_si256(vStepY, moveY));
+        vSide = _mm256_blendv_epi8(vSide, vZero, moveX);
+        vSide = _mm256_blendv_epi8(vSide, vOne, moveY);
+        
+        // Out-of-bounds cells count as walls; only in-bounds lanes load occupancy words
+        __m256i inBounds = _mm256_and_si256(
+            _mm256_and_si256(_mm256_cmpgt_epi64(vMapX, vMinusOne), _mm256_cmpgt_epi64(vWidth, vMapX)),
+            _mm256_and_si256(_mm256_cmpgt_epi64(vMapY, vMinusOne), _mm256_cmpgt_epi64(vHeight, vMapY)));
+        __m256i loadMask = _mm256_and_si256(inBounds, vActive);
+        __m256i index, bitIndex;
+        cellAddress<Layout>(vMapX, vMapY, vStride, index, bitIndex);
+        __m256i word = _mm256_mask_i64gather_epi64(vZero, words, index, loadMask, 8);
+        __m256i bit = _mm256_and_si256(_mm256_srlv_epi64(word, bitIndex), vOne);
+        
+        __m256i wall = _mm256_cmpeq_epi64(bit, vOne);
+        __m256i hit = _mm256_or_si256(_mm256_andnot_si256(inBounds, vMinusOne), wall);
+        vActive = _mm256_andnot_si256(hit, vActive);
+    }
+    
+    _mm256_store_pd(sideX, vSideX);
+    _mm256_store_pd(sideY, vSideY);
+    _mm256_store_pd(stepsX, vStepsX);
+    _mm256_store_pd(stepsY, vStepsY);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(mapX), vMapX);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(mapY), vMapY);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(side), vSide);
+    
+    for (int i = 0; i < count; i++) {
+        rays[i].sideDistX = sideX[i];
+        rays[i].sideDistY = sideY[i];
+        rays[i].stepsX = static_cast<int>(stepsX[i]);
+        rays[i].stepsY = static_cast<int>(stepsY[i]);
+        rays[i].mapX = static_cast<int>(mapX[i]);
+        rays[i].mapY = static_cast<int>(mapY[i]);
+        rays[i].side = static_cast<int>(side[i]);
+    }
+}
+
+template <CellLayout Layout>
+void traverseFloats(RayState<FloatPrecision>* rays, int count, const OccupancyGrid& grid) {
+    constexpr int WIDTH = RayPacket<FloatPrecision>::WIDTH;
+    alignas(32) float sideX[WIDTH], sideY[WIDTH], deltaX[WIDTH], deltaY[WIDTH];
+    alignas(32) float originX[WIDTH], originY[WIDTH], stepsX[WIDTH], stepsY[WIDTH];
+    alignas(32) int32_t mapX[WIDTH], mapY[WIDTH], stepX[WIDTH], stepY[WIDTH], side[WIDTH], live[WIDTH];
+    
+    for (int i = 0; i < WIDTH; i++) {
+        const RayState<FloatPrecision>& ray = rays[i < count ? i : 0];
+        sideX[i] = ray.sideDistX;
+        sideY[i] = ray.sideDistY;
+        originX[i] = ray.sideOriginX;
+        originY[i] = ray.sideOriginY;
+        stepsX[i] = static_cast<float>(ray.stepsX);
+        stepsY[i] = static_cast<float>(ray.stepsY);
+        deltaX[i] = ray.deltaDistX;
+        deltaY[i] = ray.deltaDistY;
+        mapX[i] = ray.mapX;
+        mapY[i] = ray.mapY;
+        stepX[i] = ray.stepX;
+        stepY[i] = ray.stepY;
+        side[i] = ray.side;
+        live[i] = i < count ? -1 : 0;
+    }
+    
+    __m256 vSideX = _mm256_load_ps(sideX);
+    __m256 vSideY = _mm256_load_ps(sideY);
+    const __m256 vDeltaX = _mm256_load_ps(deltaX);
+    const __m256 vDeltaY = _mm256_load_ps(deltaY);
+    const __m256 vOriginX = _mm256_load_ps(originX);
+    const __m256 vOriginY = _mm256_load_ps(originY);
+    __m256 vStepsX = _mm256_load_ps(stepsX);
+    __m256 vStepsY = _mm256_load_ps(stepsY);
+    const __m256 vOneStep = _mm256_set1_ps(1.0f);
+    __m256i vMapX = _mm256_load_si256(reinterpret_cast<const __m256i*>(mapX));
+    __m256i vMapY = _mm256_load_si256(reinterpret_cast<const __m256i*>(mapY));
+    const __m256i vStepX = _mm256_load_si256(reinterpret_cast<const __m256i*>(stepX));
+    const __m256i vStepY = _mm256_load_si256(reinterpret_cast<const __m256i*>(stepY));
+    __m256i vSide = _mm256_load_si256(reinterpret_cast<const __m256i*>(side));
+    __m256i vActive = _mm256_load_si256(reinterpret_cast<const __m256i*>(live));
+    
+    const __m256i vZero = _mm256_setzero_si256();
+    const __m256i vOne = _mm256_set1_epi32(1);
+    const __m256i vMinusOne = _mm256_set1_epi32(-1);
+    const __m256i vWidth = _mm256_set1_epi32(grid.width());
+    const __m256i vHeight = _mm256_set1_epi32(grid.height());
+    const bool tiled = Layout == CellLayout::TILED;
+    const __m256i vStride = _mm256_set1_epi32(tiled ? grid.tileWords() : grid.rowWords());
+    // Occupancy is read as 32-bit halves of the 64-bit words (little-endian)
+    const int* words = reinterpret_cast<const int*>(tiled ? grid.tileData() : grid.rowData());
+    
+    while (!_mm256_testz_si256(vActive, vActive)) {
+        // Step along X where sideDistX < sideDistY, otherwise along Y
+        __m256i takeX = _mm256_castps_si256(_mm256_cmp_ps(vSideX, vSideY, _CMP_LT_OQ));
+        __m256i moveX = _mm256_and_si256(takeX, vActive);
+        __m256i moveY = _mm256_andnot_si256(takeX, vActive);
+        
+        vStepsX = _mm256_add_ps(vStepsX, _mm256_and_ps(vOneStep, _mm256_castsi256_ps(moveX)));
+        vStepsY = _mm256_add_ps(vStepsY, _mm256_and_ps(vOneStep, _mm256_castsi256_ps(moveY)));
+        vSideX = _mm256_add_ps(vOriginX, _mm256_mul_ps(vStepsX, vDeltaX));
+        vSideY = _mm256_add_ps(vOriginY, _mm256_mul_ps(vStepsY, vDeltaY));
+        vMapX = _mm256_add_epi32(vMapX, _mm256_and_si256(vStepX, moveX));
+        vMapY = _mm256_add_epi32(vMapY, _mm256_and_si256(vStepY, moveY));
+        vSide = _mm256_blendv_epi8(vSide, vZero, moveX);
+        vSide = _mm256_blendv_epi8(vSide, vOne, moveY);
+        
+        // Out-of-bounds cells count as walls; only in-bounds lanes load occupancy words
+        __m256i inBounds = _mm256_and_si256(
+            _mm256_and_si256(_mm256_cmpgt_epi32(vMapX, vMinusOne), _mm256_cmpgt_epi32(vWidth, vMapX)),
+            _mm256_and_si256(_mm256_cmpgt_epi32(vMapY, vMinusOne), _mm256_cmpgt_epi32(vHeight, vMapY)));
+        __m256i loadMask = _mm256_and_si256(inBounds, vActive);
+        __m256i index, bitIndex;
+        halfWordAddress<Layout>(vMapX, vMapY, vStride, index, bitIndex);
+        __m256i word = _mm256_mask_i32gather_epi32(vZero, words, index, loadMask, 4);
+        __m256i bit = _mm256_and_si256(_mm256_srlv_epi32(word, bitIndex), vOne);
+        
+        __m256i wall = _mm256_cmpeq_epi32(bit, vOne);
+        __m256i hit = _mm256_or_si256(_mm256_andnot_si256(inBounds, vMinusOne), wall);
+        vActive = _mm256_andnot_si256(hit, vActive);
+    }
+    
+    _mm256_store_ps(sideX, vSideX);
+    _mm256_store_ps(sideY, vSideY);
+    _mm256_store_ps(stepsX, vStepsX);
+    _mm256_store_ps(stepsY, vStepsY);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(mapX), vMapX);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(mapY), vMapY);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(side), vSide);
+    
+    for (int i = 0; i < count; i++) {
+        rays[i].sideDistX = sideX[i];
+        rays[i].sideDistY = sideY[i];
+        rays[i].stepsX = static_cast<int>(stepsX[i]);
+        rays[i].stepsY = static_cast<int>(stepsY[i]);
+        rays[i].mapX = mapX[i];
+        rays[i].mapY = mapY[i];
+        rays[i].side = side[i];
+    }
+}
+
+} // namespace
+
+void RayPacket<DoublePrecision>::traverse(RayState<DoublePrecision>* rays, int count, const OccupancyGrid& grid) {
+    if (grid.layout() == CellLayout::TILED) {
+        traverseDoubles<CellLayout::TILED>(rays, count, grid);
+    } else {
+        traverseDoubles<CellLayout::ROW_MAJOR>(rays, count, grid);
+    }
+}
+
+void RayPacket<FloatPrecision>::traverse(RayState<FloatPrecision>* rays, int count, const OccupancyGrid& grid) {
+    if (grid.layout() == CellLayout::TILED) {
+        traverseFloats<CellLayout::TILED>(rays, count, grid);
+    } else {
+        traverseFloats<CellLayout::ROW_MAJOR>(rays, count, grid);
+    }
+}
+
+#elif defined(__SSE2__)
+
+// Without AVX2 gathers the compares and adds run in SIMD and the bit tests per lane
+void RayPacket<DoublePrecision>::traverse(RayState<DoublePrecision>* rays, int count, const OccupancyGrid& grid) {
+    if (count < WIDTH) {
+        traverseEach(rays, count, grid);
+        return;
+    }
+    
+    __m128d vSideX = _mm_set_pd(rays[1].sideDistX, rays[0].sideDistX);
+    __m128d vSideY = _mm_set_pd(rays[1].sideDistY, rays[0].sideDistY);
+    const __m128d vDeltaX = _mm_set_pd(rays[1].deltaDistX, rays[0].deltaDistX);
+    const __m128d vDeltaY = _mm_set_pd(rays[1].deltaDistY, rays[0].deltaDistY);
+    const __m128d vOriginX = _mm_set_pd(rays[1].sideOriginX, rays[0].sideOriginX);
+    const __m128d vOriginY = _mm_set_pd(rays[1].sideOriginY, rays[0].sideOriginY);
+    __m128d vStepsX = _mm_set_pd(rays[1].stepsX, rays[0].stepsX);
+    __m128d vStepsY = _mm_set_pd(rays[1].stepsY, rays[0].stepsY);
+    const __m128d vOneStep = _mm_set1_pd(1.0);
+    int active = (1 << WIDTH) - 1;
+    
+    while (active) {
+        // Step along X where sideDistX < sideDistY, otherwise along Y
+        int moveX = _mm_movemask_pd(_mm_cmplt_pd(vSideX, vSideY)) & active;
+        int moveY = ~moveX & active;
+        
+        __m128d maskX = _mm_castsi128_pd(_mm_set_epi64x(moveX & 2 ? -1 : 0, moveX & 1 ? -1 : 0));
+        __m128d maskY = _mm_castsi128_pd(_mm_set_epi64x(moveY & 2 ? -1 : 0, moveY & 1 ? -1 : 0));
+        vStepsX = _mm_add_pd(vStepsX, _mm_and_pd(vOneStep, maskX));
+        vStepsY = _mm_add_pd(vStepsY, _mm_and_pd(vOneStep, maskY));
+        vSideX = _mm_add_pd(vOriginX, _mm_mul_pd(vStepsX, vDeltaX));
+        vSideY = _mm_add_pd(vOriginY, _mm_mul_pd(vStepsY, vDeltaY));
+        
+        for (int i = 0; i < WIDTH; i++) {
+            if (!(active & (1 << i))) continue;
+            RayState<DoublePrecision>& ray = rays[i];
+            if (moveX & (1 << i)) {
+                ray.mapX += ray.stepX;
+                ray.side = 0;
+            } else {
+                ray.mapY += ray.stepY;
+                ray.side = 1;
+            }
+            if (grid.isWall(ray.mapX, ray.mapY)) {
+                active &= ~(1 << i);
+            }
+        }
+    }
+    
+    alignas(16) double sideX[WIDTH], sideY[WIDTH], stepsX[WIDTH], stepsY[WIDTH];
+    _mm_store_pd(sideX, vSideX);
+    _mm_store_pd(sideY, vSideY);
+    _mm_store_pd(stepsX, vStepsX);
+    _mm_store_pd(stepsY, vStepsY);
+    for (int i = 0; i < WIDTH; i++) {
+        rays[i].sideDistX = sideX[i];
+        rays[i].sideDistY = sideY[i];
+        rays[i].stepsX = static_cast<int>(stepsX[i]);
+        rays[i].stepsY = static_cast<int>(stepsY[i]);
+    }
+}
+
+void RayPacket<FloatPrecision>::traverse(RayState<FloatPrecision>* rays, int count, const OccupancyGrid& grid) {
+    if (count < WIDTH) {
+        traverseEach(rays, count, grid);
+        return;
+    }
+    
+    __m128 vSideX = _mm_set_ps(rays[3].sideDistX, rays[2].sideDistX, rays[1].sideDistX, rays[0].sideDistX);
+    __m128 vSideY = _mm_set_ps(rays[3].sideDistY, rays[2].sideDistY, rays[1].sideDistY, rays[0].sideDistY);
+    const __m128 vDeltaX = _mm_set_ps(rays[3].deltaDistX, rays[2].deltaDistX, rays[1].deltaDistX, rays[0].deltaDistX);
+    const __m128 vDeltaY = _mm_set_ps(rays[3].deltaDistY, rays[2].deltaDistY, rays[1].deltaDistY, rays[0].deltaDistY);
+    const __m128 vOriginX = _mm_set_ps(rays[3].sideOriginX, rays[2].sideOriginX, rays[1].sideOriginX, rays[0].sideOriginX);
+    const __m128 vOriginY = _mm_set_ps(rays[3].sideOriginY, rays[2].sideOriginY, rays[1].sideOriginY, rays[0].sideOriginY);
+    __m128 vStepsX = _mm_set_ps(static_cast<float>(rays[3].stepsX), static_cast<float>(rays[2].stepsX),
+                                static_cast<float>(rays[1].stepsX), static_cast<float>(rays[0].stepsX));
+    __m128 vStepsY = _mm_set_ps(static_cast<float>(rays[3].stepsY), static_cast<float>(rays[2].stepsY),
+                                static_cast<float>(rays[1].stepsY), static_cast<float>(rays[0].stepsY));
+    const __m128 vOneStep = _mm_set1_ps(1.0f);
+    int active = (1 << WIDTH) - 1;
+    
+    while (active) {
+        // Step along X where sideDistX < sideDistY, otherwise along Y
+        int moveX = _mm_movemask_ps(_mm_cmplt_ps(vSideX, vSideY)) & active;
+        int moveY = ~moveX & active;
+        
+        __m128 maskX = _mm_castsi128_ps(_mm_set_epi32(moveX & 8 ? -1 : 0, moveX & 4 ? -1 : 0,
+                                                      moveX & 2 ? -1 : 0, moveX & 1 ? -1 : 0));
+        __m128 maskY = _mm_castsi128_ps(_mm_set_epi32(moveY & 8 ? -1 : 0, moveY & 4 ? -1 : 0,
+                                                      moveY & 2 ? -1 : 0, moveY & 1 ? -1 : 0));
+        vStepsX = _mm_add_ps(vStepsX, _mm_and_ps(vOneStep, maskX));
+        vStepsY = _mm_add_ps(vStepsY, _mm_and_ps(vOneStep, maskY));
+        vSideX = _mm_add_ps(vOriginX, _mm_mul_ps(vStepsX, vDeltaX));
+        vSideY = _mm_add_ps(vOriginY, _mm_mul_ps(vStepsY, vDeltaY));
+        
+        for (int i = 0; i < WIDTH; i++) {
+            if (!(active & (1 << i))) continue;
+            RayState<FloatPrecision>& ray = rays[i];
+            if (moveX & (1 << i)) {
+                ray.mapX += ray.stepX;
+                ray.side = 0;
+            } else {
+                ray.mapY += ray.stepY;
+                ray.side = 1;
+            }
+            if (grid.isWall(ray.mapX, ray.mapY)) {
+                active &= ~(1 << i);
+            }
+        }
+    }
+    
+    alignas(16) float sideX[WIDTH], sideY[WIDTH], stepsX[WIDTH], stepsY[WIDTH];
+    _mm_store_ps(sideX, vSideX);
+    _mm_store_ps(sideY, vSideY);
+    _mm_store_ps(stepsX, vStepsX);
+    _mm_store_ps(stepsY, vStepsY);
+    for (int i = 0; i < WIDTH; i++) {
+        rays[i].sideDistX = sideX[i];
+        rays[i].sideDistY = sideY[i];
+        rays[i].stepsX = static_cast<int>(stepsX[i]);
+        rays[i].stepsY = static_cast<int>(stepsY[i]);
+    }
+}
+
+#else
+
+void RayPacket<DoublePrecision>::traverse(RayState<DoublePrecision>* rays, int count, const OccupancyGrid& grid) {
+    traverseEach(rays, count, grid);
+}
+
+void RayPacket<FloatPrecision>::traverse(RayState<FloatPrecision>* rays, int count, const OccupancyGrid& grid) {
+    traverseEach(rays, count, grid);
+}
+
+#endif
+
+} // namespace RaycastWorker
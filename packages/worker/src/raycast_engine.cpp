@@ -1,119 +1,387 @@
 // packages/worker/src/raycast_engine.cpp
 #include "raycast_engine.h"
+#include "visibility_set.h"
+#include "ray_packet.h"
+#include "direction_table.h"
 #include <algorithm>
+#include <functional>
+#include <type_traits>
 
 namespace RaycastWorker {
 
-void RaycastEngine::castRay(double rayAngle, double playerX, double playerY, double playerPitch,
-                           const std::vector<std::vector<int>>& map, int mapWidth, int mapHeight,
-                           double& distance, int& wallType, double& wallX) {
-    double rayX = playerX;
-    double rayY = playerY;
-    double rayDirX = cos(rayAngle) * cos(playerPitch);
-    double rayDirY = sin(rayAngle) * cos(playerPitch);
-    
-    double deltaDistX = (rayDirX == 0) ? 1e30 : std::abs(1.0 / rayDirX);
-    double deltaDistY = (rayDirY == 0) ? 1e30 : std::abs(1.0 / rayDirY);
-    
-    int mapX = (int)rayX;
-    int mapY = (int)rayY;
-    
-    double sideDistX, sideDistY;
-    int stepX, stepY;
-    int side;
+template <typename Precision>
+RayState<Precision> RaycastEngine::initRay(double rayDirX, double rayDirY, double playerX, double playerY) {
+    using P = Precision;
+    RayState<Precision> ray;
+    ray.rayDirX = P::fromDouble(rayDirX);
+    ray.rayDirY = P::fromDouble(rayDirY);
+    ray.deltaDistX = P::deltaDist(ray.rayDirX);
+    ray.deltaDistY = P::deltaDist(ray.rayDirY);
+    ray.mapX = (int)playerX;
+    ray.mapY = (int)playerY;
+    ray.stepsX = 0;
+    ray.stepsY = 0;
+    ray.side = 0;
     
-    if (rayDirX < 0) {
-        stepX = -1;
-        sideDistX = (rayX - mapX) * deltaDistX;
+    if (ray.rayDirX < 0) {
+        ray.stepX = -1;
+        ray.sideDistX = P::mul(P::fromDouble(playerX) - P::fromDouble(ray.mapX), ray.deltaDistX);
     } else {
-        stepX = 1;
-        sideDistX = (mapX + 1.0 - rayX) * deltaDistX;
+        ray.stepX = 1;
+        ray.sideDistX = P::mul(P::fromDouble(ray.mapX + 1.0) - P::fromDouble(playerX), ray.deltaDistX);
     }
     
-    if (rayDirY < 0) {
-        stepY = -1;
-        sideDistY = (rayY - mapY) * deltaDistY;
+    if (ray.rayDirY < 0) {
+        ray.stepY = -1;
+        ray.sideDistY = P::mul(P::fromDouble(playerY) - P::fromDouble(ray.mapY), ray.deltaDistY);
     } else {
-        stepY = 1;
-        sideDistY = (mapY + 1.0 - rayY) * deltaDistY;
+        ray.stepY = 1;
+        ray.sideDistY = P::mul(P::fromDouble(ray.mapY + 1.0) - P::fromDouble(playerY), ray.deltaDistY);
     }
     
+    ray.sideOriginX = ray.sideDistX;
+    ray.sideOriginY = ray.sideDistY;
+    
+    return ray;
+}
+
+void RaycastEngine::traverse(RayState<>& ray, const MapView& map) {
     // DDA algorithm
     while (true) {
-        if (sideDistX < sideDistY) {
-            sideDistX += deltaDistX;
-            mapX += stepX;
-            side = 0;
+        ray.advance();
+        if (map.isWall(ray.mapX, ray.mapY)) {
+            break;
+        }
+    }
+}
+
+template <typename Precision>
+void RaycastEngine::traverse(RayState<Precision>& ray, const OccupancyGrid& grid) {
+    // The first step is always taken before any cell is tested
+    ray.advance();
+    if (grid.isWall(ray.mapX, ray.mapY)) {
+        return;
+    }
+    
+    // Same DDA as above, but empty space is crossed without testing each cell: whole empty
+    // blocks are jumped in one go, and runs of empty cells along the current axis are found
+    // a word at a time. The sequence of cells visited is unchanged.
+    while (true) {
+        int level = grid.coarsestEmptyLevel(ray.mapX, ray.mapY);
+        if (level >= 0) {
+            skipBlock(ray, OccupancyGrid::LEVEL_SHIFTS[level]);
+            ray.advance();
+            if (grid.isWall(ray.mapX, ray.mapY)) {
+                return;
+            }
+        } else if (ray.sideDistX < ray.sideDistY) {
+            int run = grid.emptyRunX(ray.mapX, ray.mapY, ray.stepX);
+            while (run > 0 && ray.sideDistX < ray.sideDistY) {
+                ray.advanceX();
+                run--;
+            }
+            if (ray.sideDistX < ray.sideDistY) {
+                // The next X step enters a wall or leaves the map
+                ray.advanceX();
+                return;
+            }
         } else {
-            sideDistY += deltaDistY;
-            mapY += stepY;
-            side = 1;
+            int run = grid.emptyRunY(ray.mapX, ray.mapY, ray.stepY);
+            while (run > 0 && !(ray.sideDistX < ray.sideDistY)) {
+                ray.advanceY();
+                run--;
+            }
+            if (!(ray.sideDistX < ray.sideDistY)) {
+                ray.advanceY();
+                return;
+            }
         }
+    }
+}
+
+namespace {
+    // Number of steps k in [0, limit] whose side distance sideDistAt(first + k) is below
+    // `time` (or at most `time` when inclusive). Side distances grow with the step count, so
+    // a division gives the answer to within a step and exact comparisons settle it.
+    template <typename Scalar, typename SideDistAt>
+    int countStepsBefore(SideDistAt sideDistAt, Scalar delta, int first, int limit, Scalar time, bool inclusive) {
+        auto before = [&](int k) {
+            Scalar t = sideDistAt(first + k);
+            return inclusive ? t <= time : t < time;
+        };
         
-        if (mapX < 0 || mapX >= mapWidth || mapY < 0 || mapY >= mapHeight || 
-            map[mapY][mapX] == 1) {
-            break;
+        Scalar elapsed = time - sideDistAt(first);
+        int count = elapsed < 0 ? 0 : static_cast<int>(std::min<Scalar>(elapsed / delta, static_cast<Scalar>(limit)));
+        while (count < limit && before(count)) {
+            count++;
         }
+        while (count > 0 && !before(count - 1)) {
+            count--;
+        }
+        return count;
     }
+}
+
+// Moves the ray through the empty aligned block of 2^shift cells around it, stopping just
+// before the step that leaves the block. X step i comes before Y step j exactly when
+// sideDistAtX(i) < sideDistAtY(j), so the steps taken can be counted instead of walked.
+template <typename Precision>
+void RaycastEngine::skipBlock(RayState<Precision>& ray, int shift) {
+    using Scalar = typename Precision::Scalar;
+    int size = 1 << shift;
+    int blockX = ray.mapX & ~(size - 1);
+    int blockY = ray.mapY & ~(size - 1);
+    
+    // Steps along each axis until the ray is outside the block
+    int exitX = ray.stepX > 0 ? blockX + size - ray.mapX : ray.mapX - blockX + 1;
+    int exitY = ray.stepY > 0 ? blockY + size - ray.mapY : ray.mapY - blockY + 1;
+    Scalar exitTimeX = ray.sideDistAtX(ray.stepsX + exitX - 1);
+    Scalar exitTimeY = ray.sideDistAtY(ray.stepsY + exitY - 1);
+    
+    auto sideDistAtX = [&ray](int steps) { return ray.sideDistAtX(steps); };
+    auto sideDistAtY = [&ray](int steps) { return ray.sideDistAtY(steps); };
     
-    if (side == 0) {
-        distance = (sideDistX - deltaDistX);
-        wallX = playerY + distance * rayDirY;
+    if (exitTimeX < exitTimeY) {
+        // Leaves through an X boundary; Y steps tied with it go first
+        int stepsY = countStepsBefore(sideDistAtY, ray.deltaDistY, ray.stepsY, exitY - 1, exitTimeX, true);
+        ray.advanceX(exitX - 1);
+        if (stepsY > 0) {
+            ray.advanceY(stepsY);
+        }
+    } else {
+        int stepsX = countStepsBefore(sideDistAtX, ray.deltaDistX, ray.stepsX, exitX - 1, exitTimeY, false);
+        ray.advanceY(exitY - 1);
+        if (stepsX > 0) {
+            ray.advanceX(stepsX);
+        }
+    }
+}
+
+template <typename Precision>
+void RaycastEngine::finishRay(const RayState<Precision>& ray, double playerX, double playerY, double playerPitch,
+                              double& distance, int& wallType, double& wallX) {
+    using P = Precision;
+    typename P::Scalar perpDistance;
+    if (ray.side == 0) {
+        perpDistance = (ray.sideDistX - ray.deltaDistX);
+        wallX = P::toDouble(P::fromDouble(playerY) + P::mul(perpDistance, ray.rayDirY));
     } else {
-        distance = (sideDistY - deltaDistY);
-        wallX = playerX + distance * rayDirX;
+        perpDistance = (ray.sideDistY - ray.deltaDistY);
+        wallX = P::toDouble(P::fromDouble(playerX) + P::mul(perpDistance, ray.rayDirX));
     }
     
     // Prevent fisheye effect
-    distance = distance * cos(playerPitch);
+    distance = P::toDouble(P::mul(perpDistance, P::fromDouble(P::cosine(playerPitch))));
     
     // Determine wall type
-    wallType = (mapX + mapY) % 6;
+    wallType = (ray.mapX + ray.mapY) % 6;
 }
 
-std::vector<InternalRaycastResult> RaycastEngine::renderColumns(const InternalRenderRequest& request) {
-    std::vector<InternalRaycastResult> results;
-    results.reserve(request.endColumn - request.startColumn);
-    
-    for (int x = request.startColumn; x < request.endColumn; x++) {
-        double rayAngle = request.player.angle - request.fov/2 + 
-                         (x * request.fov / request.screenWidth);
-        
-        double distance, wallX;
-        int wallType;
-        
-        castRay(rayAngle, request.player.x, request.player.y, request.player.pitch,
-                request.map, request.mapWidth, request.mapHeight,
-                distance, wallType, wallX);
-        
-        // Calculate wall height
-        int wallHeight = static_cast<int>(SCREEN_HEIGHT / distance);
-        int wallTop = (SCREEN_HEIGHT - wallHeight) / 2;
-        int wallBottom = wallTop + wallHeight;
-        
-        // Calculate color
-        uint8_t intensity = calculateIntensity(distance);
-        uint8_t r, g, b;
-        getWallColor(wallType, intensity, r, g, b);
-        
-        results.push_back({
-            x, distance, wallType, wallX, wallTop, wallBottom, r, g, b
-        });
+template RayState<DoublePrecision> RaycastEngine::initRay<DoublePrecision>(double, double, double, double);
+template RayState<FloatPrecision> RaycastEngine::initRay<FloatPrecision>(double, double, double, double);
+template RayState<FixedPoint16> RaycastEngine::initRay<FixedPoint16>(double, double, double, double);
+template void RaycastEngine::traverse<DoublePrecision>(RayState<DoublePrecision>&, const OccupancyGrid&);
+template void RaycastEngine::traverse<FloatPrecision>(RayState<FloatPrecision>&, const OccupancyGrid&);
+template void RaycastEngine::traverse<FixedPoint16>(RayState<FixedPoint16>&, const OccupancyGrid&);
+template void RaycastEngine::finishRay<DoublePrecision>(const RayState<DoublePrecision>&, double, double, double,
+                                                        double&, int&, double&);
+template void RaycastEngine::finishRay<FloatPrecision>(const RayState<FloatPrecision>&, double, double, double,
+                                                       double&, int&, double&);
+template void RaycastEngine::finishRay<FixedPoint16>(const RayState<FixedPoint16>&, double, double, double,
+                                                     double&, int&, double&);
+
+void RaycastEngine::castRay(double rayAngle, double playerX, double playerY, double playerPitch,
+                           const MapView& map, double& distance, int& wallType, double& wallX) {
+    RayState<> ray = initRay(cos(rayAngle) * cos(playerPitch), sin(rayAngle) * cos(playerPitch),
+                             playerX, playerY);
+    traverse(ray, map);
+    finishRay(ray, playerX, playerY, playerPitch, distance, wallType, wallX);
+}
+
+void RaycastEngine::castRay(double rayAngle, double playerX, double playerY, double playerPitch,
+                           const OccupancyGrid& grid, double& distance, int& wallType, double& wallX) {
+    RayState<> ray = initRay(cos(rayAngle) * cos(playerPitch), sin(rayAngle) * cos(playerPitch),
+                             playerX, playerY);
+    traverse(ray, grid);
+    finishRay(ray, playerX, playerY, playerPitch, distance, wallType, wallX);
+}
+
+void RaycastEngine::castRay(double rayAngle, double playerX, double playerY, double playerPitch,
+                           const OccupancyGrid& grid, const VisibilitySet& visibility,
+                           double& distance, int& wallType, double& wallX) {
+    castRay(rayAngle, playerX, playerY, playerPitch, visibleGrid(grid, &visibility, playerX, playerY),
+            distance, wallType, wallX);
+}
+
+const OccupancyGrid& RaycastEngine::visibleGrid(const OccupancyGrid& grid, const VisibilitySet* visibility,
+                                                double playerX, double playerY) {
+    if (!visibility || visibility->width() != grid.width() || visibility->height() != grid.height()) {
+        return grid;
+    }
+    int cellX = static_cast<int>(std::floor(playerX));
+    int cellY = static_cast<int>(std::floor(playerY));
+    if (!visibility->hasCell(cellX, cellY)) {
+        return grid;
     }
     
+    // Players stay in a cell for many frames, so keep the last decoded cell per thread
+    struct DecodedCell {
+        uint64_t setId = 0;
+        int cellX = -1, cellY = -1;
+        OccupancyGrid grid;
+    };
+    thread_local DecodedCell decoded;
+    if (decoded.setId != visibility->id() || decoded.cellX != cellX || decoded.cellY != cellY ||
+        decoded.grid.layout() != grid.layout()) {
+        decoded.grid.setLayout(grid.layout());
+        visibility->decode(cellX, cellY, decoded.grid);
+        decoded.setId = visibility->id();
+        decoded.cellX = cellX;
+        decoded.cellY = cellY;
+    }
+    return decoded.grid;
+}
+
+std::vector<InternalRaycastResult> RaycastEngine::renderColumns(const InternalRenderRequest& request,
+                                                                ThreadPool* pool, int minChunkColumns) {
+    std::vector<InternalRaycastResult> results;
+    renderColumns(request, pool, minChunkColumns, results);
     return results;
 }
 
-bool RaycastEngine::isWall(double x, double y, const std::vector<std::vector<int>>& map,
-                          int mapWidth, int mapHeight) {
-    int mapX = (int)x;
-    int mapY = (int)y;
+void RaycastEngine::renderColumns(const InternalRenderRequest& request, ThreadPool* pool, int minChunkColumns,
+                                  std::vector<InternalRaycastResult>& results) {
+    results.resize(std::max(request.endColumn - request.startColumn, 0));
+    if (results.empty()) {
+        return; // An empty range has no first column to write to
+    }
+    
+    // Pack the map into occupancy bits once for all columns of this request. The grid is kept
+    // per thread, so later requests reuse its storage instead of allocating it again.
+    thread_local OccupancyGrid localGrid;
+    const OccupancyGrid* grid = request.occupancy;
+    if (!grid) {
+        localGrid.setLayout(request.layout);
+        localGrid.build(request.map);
+        grid = &localGrid;
+    }
+    // Walls hidden from the player's cell cannot be hit, so traverse without them
+    grid = &visibleGrid(*grid, request.visibility, request.player.x, request.player.y);
+    
+    // Fixed point builds its rays from its own trig, so they come out the same on every worker
+    Camera camera = request.precision == RenderPrecision::FIXED_16_16 ? makeCamera<FixedPoint16>(request)
+                                                                      : makeCamera<DoublePrecision>(request);
+    
+    auto render = [&](int begin, int end) {
+        InternalRaycastResult* out = &results[begin - request.startColumn];
+        switch (request.precision) {
+            case RenderPrecision::FLOAT:
+                renderRange<FloatPrecision>(request, camera, *grid, begin, end, out);
+                break;
+            case RenderPrecision::FIXED_16_16:
+                renderRange<FixedPoint16>(request, camera, *grid, begin, end, out);
+                break;
+            case RenderPrecision::DOUBLE:
+            default:
+                renderRange<DoublePrecision>(request, camera, *grid, begin, end, out);
+                break;
+        }
+    };
     
-    if (mapX < 0 || mapX >= mapWidth || mapY < 0 || mapY >= mapHeight) {
-        return true;
+    if (pool) {
+        // Passed by reference so wrapping it in a std::function does not allocate
+        pool->parallelFor(request.startColumn, request.endColumn, minChunkColumns, std::ref(render));
+    } else {
+        render(request.startColumn, request.endColumn);
     }
+}
+
+template <typename Precision>
+RaycastEngine::Camera RaycastEngine::makeCamera(const InternalRenderRequest& request) {
+    using P = Precision;
     
-    return map[mapY][mapX] == 1;
+    // Camera direction and plane for this frame; per-column offsets come from the cached table
+    Camera camera;
+    camera.table = DirectionTable::get(request.screenWidth, request.fov, std::is_same<P, FixedPoint16>::value);
+    double cosPitch = P::cosine(request.player.pitch);
+    camera.dirX = P::cosine(request.player.angle) * cosPitch;
+    camera.dirY = P::sine(request.player.angle) * cosPitch;
+    camera.planeX = -camera.dirY;
+    camera.planeY = camera.dirX;
+    return camera;
+}
+
+template <typename Precision>
+void RaycastEngine::renderRange(const InternalRenderRequest& request, const Camera& camera,
+                                const OccupancyGrid& grid, int startColumn, int endColumn,
+                                InternalRaycastResult* out) {
+    const DirectionTable& table = *camera.table;
+    const double playerX = request.player.x;
+    const double playerY = request.player.y;
+    const double pitch = request.player.pitch;
+    
+    // Adjacent columns are traversed together as one ray packet, unless the map is open enough
+    // that the scalar traversal's block skipping outruns the packet's cell-by-cell stepping
+    using Packet = RayPacket<Precision>;
+    const bool usePackets = grid.emptyFraction() < OPEN_MAP_EMPTY_FRACTION;
+    for (int x0 = startColumn; x0 < endColumn; x0 += Packet::WIDTH) {
+        int count = std::min(Packet::WIDTH, endColumn - x0);
+        RayState<Precision> rays[Packet::WIDTH];
+        
+        for (int i = 0; i < count; i++) {
+            int x = x0 + i;
+            double cosOffset, sinOffset;
+            if (x >= 0 && x < table.screenWidth()) {
+                cosOffset = table.cosOffset(x);
+                sinOffset = table.sinOffset(x);
+            } else {
+                // Columns outside the screen still get a ray, just not a cached one
+                double offset = -request.fov/2 + (x * request.fov / request.screenWidth);
+                cosOffset = Precision::cosine(offset);
+                sinOffset = Precision::sine(offset);
+            }
+            rays[i] = initRay<Precision>(camera.dirX * cosOffset + camera.planeX * sinOffset,
+                                         camera.dirY * cosOffset + camera.planeY * sinOffset,
+                                         playerX, playerY);
+        }
+        
+        if (usePackets && count == Packet::WIDTH) {
+            Packet::traverse(rays, count, grid);
+        } else {
+            for (int i = 0; i < count; i++) {
+                traverse(rays[i], grid);
+            }
+        }
+        
+        for (int i = 0; i < count; i++) {
+            double distance, wallX;
+            int wallType;
+            finishRay(rays[i], playerX, playerY, pitch, distance, wallType, wallX);
+            
+            // Calculate wall height
+            int wallHeight = static_cast<int>(SCREEN_HEIGHT / distance);
+            int wallTop = (SCREEN_HEIGHT - wallHeight) / 2;
+            int wallBottom = wallTop + wallHeight;
+            
+            // Calculate color
+            uint8_t intensity = calculateIntensity(distance);
+            uint8_t r, g, b;
+            getWallColor(wallType, intensity, r, g, b);
+            
+            *out++ = {
+                x0 + i, distance, wallType, wallX, wallTop, wallBottom, r, g, b,
+                rays[i].stepsX + rays[i].stepsY
+            };
+        }
+    }
+}
+
+bool RaycastEngine::isWall(double x, double y, const MapView& map) {
+    return map.isWall((int)x, (int)y);
+}
+
+bool RaycastEngine::isWall(double x, double y, const OccupancyGrid& grid) {
+    return grid.isWall((int)x, (int)y);
 }
 
 uint8_t RaycastEngine::calculateIntensity(double distance) {
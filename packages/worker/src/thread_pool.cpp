@@ -0,0 +1,192 @@
+// packages/worker/src/thread_pool.cpp
+#include "thread_pool.h"
+#include <algorithm>
+
+namespace RaycastWorker {
+
+namespace {
+    // Index of the pool thread running on this thread, -1 for outside threads
+    thread_local int t_queueIndex = -1;
+}
+
+ThreadPool::ThreadPool(int numThreads)
+    : pending_(0), nextQueue_(0), stop_(false) {
+    numThreads = std::max(numThreads, 0);
+    for (int i = 0; i < numThreads; i++) {
+        queues_.push_back(std::make_unique<TaskQueue>());
+    }
+    for (int i = 0; i < numThreads; i++) {
+        threads_.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    if (threads_.empty()) {
+        task();
+        return;
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(submitted_.mutex);
+        submitted_.tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        pending_++;
+    }
+    wake_.notify_one();
+}
+
+void ThreadPool::pushHelper(std::function<void()> task) {
+    // Pool threads push onto their own deque; everyone else spreads tasks round-robin
+    size_t index = t_queueIndex >= 0 ? static_cast<size_t>(t_queueIndex)
+                                     : nextQueue_.fetch_add(1) % queues_.size();
+    {
+        std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+        queues_[index]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        pending_++;
+    }
+    wake_.notify_one();
+}
+
+bool ThreadPool::runOne(int index) {
+    std::function<void()> task;
+    size_t count = queues_.size();
+    
+    // Own deque first (newest task), then steal the oldest task from the others, and only
+    // then start the oldest submitted task
+    for (size_t i = 0; i < count && !task; i++) {
+        TaskQueue& queue = *queues_[(index + i) % count];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            continue;
+        }
+        if (i == 0) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+    }
+    if (!task) {
+        std::lock_guard<std::mutex> lock(submitted_.mutex);
+        if (!submitted_.tasks.empty()) {
+            task = std::move(submitted_.tasks.front());
+            submitted_.tasks.pop_front();
+        }
+    }
+    
+    if (!task) {
+        return false;
+    }
+    pending_--;
+    task();
+    return true;
+}
+
+void ThreadPool::workerLoop(int index) {
+    t_queueIndex = index;
+    while (true) {
+        if (runOne(index)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        wake_.wait(lock, [this] { return stop_ || pending_.load() > 0; });
+        if (stop_ && pending_.load() == 0) {
+            return;
+        }
+    }
+}
+
+void ThreadPool::parallelFor(int begin, int end, int minChunk, const std::function<void(int, int)>& fn) {
+    int total = end - begin;
+    if (total <= 0) {
+        return;
+    }
+    
+    minChunk = std::max(minChunk, 1);
+    int maxChunks = (size() + 1) * 4; // A few chunks per thread so stealing can even out the load
+    int numChunks = std::min((total + minChunk - 1) / minChunk, maxChunks);
+    if (numChunks <= 1 || threads_.empty()) {
+        fn(begin, end);
+        return;
+    }
+    int chunkSize = (total + numChunks - 1) / numChunks;
+    numChunks = (total + chunkSize - 1) / chunkSize;
+    
+    // Helpers may start after all chunks are taken, so the shared state outlives this call.
+    // States are reused once every helper holding one is done with it, and the task only
+    // captures a pointer, so steady-state calls do not allocate.
+    int helpers = std::min(numChunks - 1, size());
+    ParallelForState* state = acquireState(helpers + 1);
+    state->nextChunk.store(0);
+    state->completed = 0;
+    state->begin = begin;
+    state->end = end;
+    state->chunkSize = chunkSize;
+    state->numChunks = numChunks;
+    state->fn = &fn;
+    
+    for (int i = 0; i < helpers; i++) {
+        pushHelper([state] {
+            runChunks(state);
+            state->refs.fetch_sub(1, std::memory_order_release);
+        });
+    }
+    runChunks(state);
+    
+    {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->done.wait(lock, [&] { return state->completed == state->numChunks; });
+    }
+    state->refs.fetch_sub(1, std::memory_order_release);
+}
+
+void ThreadPool::runChunks(ParallelForState* state) {
+    int finished = 0;
+    int chunk;
+    while ((chunk = state->nextChunk.fetch_add(1)) < state->numChunks) {
+        int chunkBegin = state->begin + chunk * state->chunkSize;
+        (*state->fn)(chunkBegin, std::min(chunkBegin + state->chunkSize, state->end));
+        finished++;
+    }
+    if (finished > 0) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->completed += finished;
+        if (state->completed == state->numChunks) {
+            state->done.notify_all();
+        }
+    }
+}
+
+// Claims a state no thread is using, for refs threads. States are owned by the pool rather
+// than the calling thread, since a caller may exit while late helpers still hold its state.
+ThreadPool::ParallelForState* ThreadPool::acquireState(int refs) {
+    std::lock_guard<std::mutex> lock(statesMutex_);
+    for (auto& state : states_) {
+        if (state->refs.load(std::memory_order_acquire) == 0) {
+            state->refs.store(refs);
+            return state.get();
+        }
+    }
+    states_.push_back(std::make_unique<ParallelForState>());
+    states_.back()->refs.store(refs);
+    return states_.back().get();
+}
+
+} // namespace RaycastWorker
@@ -0,0 +1,140 @@
+// packages/worker/src/visibility_set.cpp
+#include "visibility_set.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+namespace RaycastWorker {
+
+namespace {
+    // Widens each beam slightly so rays that reduced precision kernels round across a
+    // cell boundary are still covered
+    constexpr double BEAM_MARGIN = 1.0 / 16;
+
+    std::atomic<uint64_t> nextSetId{1};
+}
+
+bool VisibilitySet::build(const OccupancyGrid& grid, int beamsPerOctant, int maxCells) {
+    width_ = 0;
+    height_ = 0;
+    offsets_.clear();
+    runs_.clear();
+    id_ = nextSetId.fetch_add(1);
+
+    int64_t cells = static_cast<int64_t>(grid.width()) * grid.height();
+    if (cells <= 0 || cells > maxCells || beamsPerOctant <= 0) {
+        return false;
+    }
+
+    width_ = grid.width();
+    height_ = grid.height();
+    offsets_.assign(static_cast<size_t>(cells) + 1, 0);
+    std::vector<uint64_t> visible((static_cast<size_t>(cells) + 63) / 64);
+
+    for (int y = 0; y < height_; y++) {
+        for (int x = 0; x < width_; x++) {
+            size_t cell = cellIndex(x, y);
+            offsets_[cell] = static_cast<uint32_t>(runs_.size());
+            if (grid.isWall(x, y)) continue;
+
+            std::fill(visible.begin(), visible.end(), 0);
+            castBeams(grid, x, y, beamsPerOctant, visible);
+
+            // Run-length encode the visible walls
+            for (size_t w = 0; w < visible.size(); w++) {
+                for (uint64_t bits = visible[w]; bits; ) {
+                    int first = __builtin_ctzll(bits);
+                    uint64_t rest = ~(bits >> first);
+                    int length = rest ? __builtin_ctzll(rest) : 64 - first;
+                    uint32_t start = static_cast<uint32_t>((w << 6) + first);
+                    if (runs_.size() > offsets_[cell] &&
+                        runs_.back().start + runs_.back().length == start) {
+                        runs_.back().length += length;
+                    } else {
+                        runs_.push_back({start, static_cast<uint32_t>(length)});
+                    }
+                    bits = first + length >= 64 ? 0 : bits & (~uint64_t(0) << (first + length));
+                }
+            }
+        }
+    }
+    offsets_[static_cast<size_t>(cells)] = static_cast<uint32_t>(runs_.size());
+    runs_.shrink_to_fit();
+    return true;
+}
+
+// Sweeps the rays leaving the cell as thin beams, one per slope interval of each octant.
+// Each beam is walked column by column along its major axis: every wall the beam overlaps
+// before it is fully blocked is marked visible. A column fully blocks the beam when all
+// the cells the beam covers there are walls, since every ray must enter one of them.
+void VisibilitySet::castBeams(const OccupancyGrid& grid, int cellX, int cellY, int beamsPerOctant,
+                              std::vector<uint64_t>& visible) const {
+    for (int octant = 0; octant < 8; octant++) {
+        const bool swapAxes = octant & 4;
+        const int stepMajor = (octant & 1) ? -1 : 1;
+        const int stepMinor = (octant & 2) ? -1 : 1;
+        const int majorStart = swapAxes ? cellY : cellX;
+        const int majorLimit = swapAxes ? height_ : width_;
+
+        for (int beam = 0; beam < beamsPerOctant; beam++) {
+            double slopeLo = static_cast<double>(beam) / beamsPerOctant;
+            double slopeHi = static_cast<double>(beam + 1) / beamsPerOctant;
+
+            for (int k = 0; ; k++) {
+                int major = majorStart + stepMajor * k;
+                if (major < 0 || major >= majorLimit) break;
+
+                // Distance along the major axis from a start point in the cell to this column
+                double reachLo = k == 0 ? 0.0 : k - 1.0;
+                double reachHi = k + 1.0;
+                int minorLo = static_cast<int>(std::floor(reachLo * slopeLo - BEAM_MARGIN));
+                int minorHi = static_cast<int>(std::floor(1.0 + reachHi * slopeHi + BEAM_MARGIN));
+
+                bool blocked = true;
+                for (int j = minorLo; j <= minorHi; j++) {
+                    int x = swapAxes ? cellX + stepMinor * j : major;
+                    int y = swapAxes ? major : cellY + stepMinor * j;
+                    if (!grid.inBounds(x, y)) continue;
+                    if (grid.isWall(x, y)) {
+                        size_t cell = cellIndex(x, y);
+                        visible[cell >> 6] |= uint64_t(1) << (cell & 63);
+                    } else {
+                        blocked = false;
+                    }
+                }
+                if (blocked) break;
+            }
+        }
+    }
+}
+
+size_t VisibilitySet::memoryBytes() const {
+    return offsets_.size() * sizeof(uint32_t) + runs_.size() * sizeof(CellRun);
+}
+
+size_t VisibilitySet::visibleCount(int x, int y) const {
+    size_t count = 0;
+    for (const CellRun* run = runsBegin(x, y); run != runsEnd(x, y); ++run) {
+        count += run->length;
+    }
+    return count;
+}
+
+bool VisibilitySet::isVisible(int fromX, int fromY, int wallX, int wallY) const {
+    if (!hasCell(fromX, fromY) || wallX < 0 || wallX >= width_ || wallY < 0 || wallY >= height_) {
+        return false;
+    }
+    uint32_t cell = static_cast<uint32_t>(cellIndex(wallX, wallY));
+    const CellRun* begin = runsBegin(fromX, fromY);
+    const CellRun* end = runsEnd(fromX, fromY);
+    const CellRun* next = std::upper_bound(begin, end, cell,
+                                           [](uint32_t c, const CellRun& run) { return c < run.start; });
+    return next != begin && cell < (next - 1)->start + (next - 1)->length;
+}
+
+void VisibilitySet::decode(int x, int y, OccupancyGrid& out) const {
+    const CellRun* begin = runsBegin(x, y);
+    out.build(width_, height_, begin, static_cast<size_t>(runsEnd(x, y) - begin));
+}
+
+} // namespace RaycastWorker
@@ -1,6 +1,15 @@
 // packages/worker/src/worker.cpp
 #include "raycast_engine.h"
 #include "worker_types.h"
+#include "thread_pool.h"
+#include "cpu_quota.h"
+#include "map_cache.h"
+#include "MapHash.h"
+#include "MapCodec.h"
+#include "ColumnCodec.h"
+#include "StepHistogram.h"
+#include "ArenaMessagePool.h"
+#include "AllocationCounter.h"
 #include <iostream>
 #include <thread>
 #include <chrono>
@@ -9,6 +18,7 @@
 #include <unistd.h>
 #include <functional>
 #include <cstdlib>
+#include <algorithm>
 
 // gRPC includes
 #include <grpcpp/grpcpp.h>
@@ -19,17 +29,163 @@ using grpc::ServerBuilder;
 using grpc::ServerContext;
 using grpc::Status;
 
-class RaycastWorkerServiceImpl final : public RaycastWorker::WorkerService::Service {
+// Rendering goes through the callback API so its messages can live on arenas and sessions
+// need no thread while idle; the renders themselves run on the render pool, so gRPC's
+// callback threads only hand them over. The other methods stay synchronous.
+using RenderCallbackService = RaycastWorker::WorkerService::WithCallbackMethod_ProcessRenderRequest<
+    RaycastWorker::WorkerService::WithCallbackMethod_RenderSession<RaycastWorker::WorkerService::Service>>;
+
+class RaycastWorkerServiceImpl final : public RenderCallbackService {
 private:
+    static constexpr double ALLOCATION_AVERAGE_WEIGHT = 0.05; // Per request, for the moving average
+    
     int workerId_;
     RaycastWorker::InternalWorkerStatus status_;
     std::atomic<int> activeJobs_;
     std::atomic<int> totalJobsProcessed_;
     std::atomic<double> totalProcessingTime_;
+    std::unique_ptr<RaycastWorker::ThreadPool> renderPool_; // Null if nothing needs one
+    bool poolRenders_;  // Whether whole renders are handed to the pool (callback server only)
+    bool splitRenders_; // Whether one render is spread across the pool
+    int minChunkColumns_;
+    RaycastWorker::CellLayout mapLayout_;
+    RaycastWorker::MapCache mapCache_;
+    // Callback server only; the async server puts each call on an arena of its own
+    std::unique_ptr<ArenaMessagePool<RaycastWorker::RenderRequest, RaycastWorker::RenderResponse>> renderMessages_;
+    std::atomic<int64_t> lastRequestAllocations_;
+    std::atomic<double> allocationsPerRequest_;
+    std::atomic<int> activeSessions_;
+    
+    // One RenderSession stream. Frames are handled one at a time: read, render into a request
+    // built from the open message, write, then read the next, so a client sending faster than
+    // the worker renders is held back by flow control. Under the callback server frames render
+    // on the render pool and are written from there; the async server has no pool for whole
+    // renders, so its sessions render in the reaction itself.
+    class RenderSessionReactor final
+        : public grpc::ServerBidiReactor<RaycastWorker::RenderSessionRequest, RaycastWorker::RenderSessionResponse> {
+    private:
+        RaycastWorkerServiceImpl* service_;
+        RaycastWorker::RenderSessionRequest incoming_;
+        RaycastWorker::RenderRequest frameRequest_;
+        RaycastWorker::RenderSessionResponse outgoing_;
+        uint64_t sessionMapVersion_;
+        bool opened_;
+        
+    public:
+        explicit RenderSessionReactor(RaycastWorkerServiceImpl* service)
+            : service_(service), sessionMapVersion_(0), opened_(false) {
+            service_->activeSessions_++;
+            StartRead(&incoming_);
+        }
+        
+        void OnReadDone(bool ok) override {
+            // The client closed its side; every frame it sent has been answered
+            if (!ok) {
+                Finish(Status::OK);
+                return;
+            }
+            if (!opened_) {
+                Status status = open();
+                if (!status.ok()) {
+                    Finish(status);
+                    return;
+                }
+                StartRead(&incoming_);
+                return;
+            }
+            if (service_->poolRenders_) {
+                // The reaction returns at once; the frame is written when its render completes
+                service_->renderPool_->submit([this] { renderAndWrite(); });
+            } else {
+                renderAndWrite();
+            }
+        }
+        
+        void OnWriteDone(bool ok) override {
+            if (!ok) {
+                Finish(Status(grpc::StatusCode::CANCELLED, "RenderSession closed by the client"));
+                return;
+            }
+            StartRead(&incoming_);
+        }
+        
+        void OnDone() override {
+            service_->activeSessions_--;
+            delete this;
+        }
+        
+    private:
+        void renderAndWrite() {
+            Status status = renderFrame();
+            if (!status.ok()) {
+                Finish(status);
+                return;
+            }
+            StartWrite(&outgoing_);
+        }
+        
+        Status open() {
+            if (incoming_.kind_case() != RaycastWorker::RenderSessionRequest::kOpen) {
+                return Status(grpc::StatusCode::INVALID_ARGUMENT, "RenderSession must start with an open message");
+            }
+            const auto& open = incoming_.open();
+            if (open.map_id().empty()) {
+                return Status(grpc::StatusCode::INVALID_ARGUMENT, "RenderSession requires a map_id");
+            }
+            frameRequest_.set_player_id(open.player_id());
+            frameRequest_.mutable_player()->set_id(open.player_id());
+            frameRequest_.set_map_id(open.map_id());
+            frameRequest_.set_screen_width(open.screen_width());
+            frameRequest_.set_screen_height(open.screen_height());
+            frameRequest_.set_fov(open.fov());
+            frameRequest_.set_precision(open.precision());
+            frameRequest_.set_result_encoding(open.result_encoding());
+            frameRequest_.set_step_bucket_columns(open.step_bucket_columns());
+            sessionMapVersion_ = open.map_version();
+            opened_ = true;
+            return Status::OK;
+        }
+        
+        Status renderFrame() {
+            if (incoming_.kind_case() != RaycastWorker::RenderSessionRequest::kFrame) {
+                return Status(grpc::StatusCode::INVALID_ARGUMENT, "RenderSession is already open");
+            }
+            const auto& frame = incoming_.frame();
+            auto* player = frameRequest_.mutable_player();
+            player->set_x(frame.pose().x());
+            player->set_y(frame.pose().y());
+            player->set_angle(frame.pose().angle());
+            player->set_pitch(frame.pose().pitch());
+            frameRequest_.set_start_column(frame.start_column());
+            frameRequest_.set_end_column(frame.end_column());
+            frameRequest_.set_map_version(frame.map_version() != 0 ? frame.map_version() : sessionMapVersion_);
+            
+            outgoing_.Clear();
+            outgoing_.set_frame_id(frame.frame_id());
+            return service_->renderRequest(&frameRequest_, outgoing_.mutable_result());
+        }
+    };
     
 public:
-    RaycastWorkerServiceImpl(int workerId) 
-        : workerId_(workerId), activeJobs_(0), totalJobsProcessed_(0), totalProcessingTime_(0.0) {
+    // asyncServer says whether AsyncWorkerServer will serve the unary calls instead of the
+    // callback methods registered here
+    RaycastWorkerServiceImpl(int workerId, int renderThreads, int minChunkColumns, size_t mapCacheBytes,
+                             RaycastWorker::CellLayout mapLayout, bool asyncServer) 
+        : workerId_(workerId), activeJobs_(0), totalJobsProcessed_(0), totalProcessingTime_(0.0),
+          poolRenders_(!asyncServer), splitRenders_(renderThreads > 1), minChunkColumns_(minChunkColumns),
+          mapLayout_(mapLayout), mapCache_(mapCacheBytes, mapLayout),
+          lastRequestAllocations_(0), allocationsPerRequest_(0.0), activeSessions_(0) {
+        // The thread running a render renders a chunk itself. Callback renders run on the pool,
+        // so it needs a thread per render thread; async renders run on the queue threads, so
+        // the pool only needs the rest, and none when renders are not split.
+        if (poolRenders_) {
+            renderMessages_ = std::make_unique<
+                ArenaMessagePool<RaycastWorker::RenderRequest, RaycastWorker::RenderResponse>>();
+            SetMessageAllocatorFor_ProcessRenderRequest(renderMessages_.get());
+            renderPool_ = std::make_unique<RaycastWorker::ThreadPool>(std::max(renderThreads, 1));
+        } else if (splitRenders_) {
+            renderPool_ = std::make_unique<RaycastWorker::ThreadPool>(renderThreads - 1);
+        }
         status_.workerId = workerId_;
         status_.status = "idle";
         status_.activeJobs.store(0);
@@ -39,18 +195,143 @@ public:
             std::chrono::system_clock::now().time_since_epoch()).count();
     }
     
-    Status ProcessRenderRequest(ServerContext* context, 
-                               const RaycastWorker::RenderRequest* request,
-                               RaycastWorker::RenderResponse* response) override {
+    // Hands the render to the pool and finishes the call from there, with request and
+    // response on a recycled arena that lives until the call is done
+    grpc::ServerUnaryReactor* ProcessRenderRequest(grpc::CallbackServerContext* context,
+                                                   const RaycastWorker::RenderRequest* request,
+                                                   RaycastWorker::RenderResponse* response) override {
+        grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
+        renderPool_->submit([this, reactor, request, response] {
+            reactor->Finish(renderRequest(request, response));
+        });
+        return reactor;
+    }
+    
+    grpc::ServerBidiReactor<RaycastWorker::RenderSessionRequest, RaycastWorker::RenderSessionResponse>*
+    RenderSession(grpc::CallbackServerContext* context) override {
+        return new RenderSessionReactor(this);
+    }
+    
+    Status GetWorkerStatus(ServerContext* context, 
+                          const RaycastWorker::StatusRequest* request,
+                          RaycastWorker::WorkerStatus* response) override {
+        
+        response->set_worker_id(status_.workerId);
+        response->set_status(status_.status);
+        response->set_active_jobs(status_.activeJobs.load());
+        response->set_total_jobs_processed(status_.totalJobsProcessed.load());
+        response->set_average_processing_time_ms(status_.averageProcessingTimeMs);
+        response->set_last_heartbeat(status_.lastHeartbeat);
+        response->set_cached_maps(static_cast<int32_t>(mapCache_.size()));
+        response->set_map_cache_bytes(static_cast<int64_t>(mapCache_.usedBytes()));
+        response->set_map_cache_hits(static_cast<int64_t>(mapCache_.hits()));
+        response->set_map_cache_misses(static_cast<int64_t>(mapCache_.misses()));
+        response->set_last_request_allocations(lastRequestAllocations_.load());
+        response->set_allocations_per_request(allocationsPerRequest_.load());
+        response->set_active_sessions(activeSessions_.load());
+        
+        return Status::OK;
+    }
+    
+    Status UploadMap(ServerContext* context,
+                     const RaycastWorker::UploadMapRequest* request,
+                     RaycastWorker::UploadMapResponse* response) override {
+        
+        int width = request->map_width();
+        int height = request->map_height();
+        std::vector<int32_t> cells;
+        if (request->map_encoding() != RaycastWorker::MAP_ENCODING_NONE) {
+            if (!decodeMapCells(request->map_cells(), static_cast<MapCellEncoding>(request->map_encoding()),
+                                request->map_cells_compressed(), width, height, cells)) {
+                return Status(grpc::StatusCode::INVALID_ARGUMENT, "Malformed map_cells");
+            }
+        } else {
+            if (width < 0 || height < 0 ||
+                static_cast<int64_t>(request->map_size()) < static_cast<int64_t>(width) * height) {
+                return Status(grpc::StatusCode::INVALID_ARGUMENT, "Map data smaller than map dimensions");
+            }
+            cells.assign(request->map().begin(), request->map().begin() + static_cast<size_t>(width) * height);
+        }
+        
+        // The cells must hash to content_id. map_id names the map through its deltas, so it is
+        // the same hash only for version 1; later versions must carry both.
+        uint64_t version = std::max<uint64_t>(request->map_version(), 1);
+        uint64_t contentHash = computeMapHash(cells.data(), cells.size(), width, height);
+        std::string contentId = formatMapId(contentHash);
+        if (!request->content_id().empty() && request->content_id() != contentId) {
+            return Status(grpc::StatusCode::INVALID_ARGUMENT, "content_id does not match the map contents");
+        }
+        std::string mapId = request->map_id();
+        if (version == 1) {
+            if (!mapId.empty() && mapId != contentId) {
+                return Status(grpc::StatusCode::INVALID_ARGUMENT, "map_id does not match the map contents");
+            }
+            mapId = contentId;
+        } else if (mapId.empty() || request->content_id().empty()) {
+            return Status(grpc::StatusCode::INVALID_ARGUMENT, "map_id and content_id are required for map versions after 1");
+        }
+        
+        try {
+            auto cachedMap = mapCache_.insert(mapId, contentHash, std::move(cells), width, height, version);
+            std::shared_lock<std::shared_mutex> mapLock(cachedMap->mutex);
+            response->set_map_version(cachedMap->version);
+        } catch (const std::exception& e) {
+            std::cerr << "Error caching map " << mapId << ": " << e.what() << std::endl;
+            return Status(grpc::StatusCode::INTERNAL, "Internal processing error");
+        }
         
+        response->set_map_id(mapId);
+        return Status::OK;
+    }
+    
+    Status ApplyMapDelta(ServerContext* context,
+                         const RaycastWorker::MapDeltaRequest* request,
+                         RaycastWorker::MapDeltaResponse* response) override {
+        
+        std::vector<RaycastWorker::MapCellChange> changes;
+        changes.reserve(request->changes_size());
+        for (const auto& change : request->changes()) {
+            changes.push_back({change.x(), change.y(), change.value()});
+        }
+        
+        uint64_t version = request->version() != 0 ? request->version() : request->base_version() + 1;
+        uint64_t currentVersion = 0;
+        switch (mapCache_.applyDelta(request->map_id(), request->base_version(), version, changes, currentVersion)) {
+            case RaycastWorker::MapCache::DeltaResult::NOT_FOUND:
+                return Status(grpc::StatusCode::NOT_FOUND, "Map not cached: " + request->map_id());
+            case RaycastWorker::MapCache::DeltaResult::STALE_VERSION:
+                return versionMismatch(request->map_id(), currentVersion);
+            case RaycastWorker::MapCache::DeltaResult::INVALID_VERSION:
+                return Status(grpc::StatusCode::INVALID_ARGUMENT,
+                              "Map delta version " + std::to_string(version) + " does not follow base version " +
+                              std::to_string(request->base_version()));
+            case RaycastWorker::MapCache::DeltaResult::OUT_OF_BOUNDS:
+                return Status(grpc::StatusCode::INVALID_ARGUMENT, "Map delta changes a cell outside the map");
+            case RaycastWorker::MapCache::DeltaResult::APPLIED:
+                break;
+        }
+        
+        response->set_map_id(request->map_id());
+        response->set_map_version(currentVersion);
+        return Status::OK;
+    }
+    
+    // Renders one request; shared by the callback method and the completion-queue server
+    Status renderRequest(const RaycastWorker::RenderRequest* request, RaycastWorker::RenderResponse* response) {
         auto startTime = std::chrono::high_resolution_clock::now();
+        uint64_t allocationsBefore = threadAllocationCount();
         activeJobs_++;
         status_.activeJobs.store(activeJobs_.load());
         status_.status = "busy";
         
         try {
-            // Convert protobuf request to internal format
-            RaycastWorker::InternalRenderRequest internalRequest;
+            // Convert protobuf request to internal format. The request and result buffers are
+            // reused by the next request on this thread, so pointers from the last one are cleared.
+            thread_local RaycastWorker::InternalRenderRequest internalRequest;
+            thread_local std::vector<RaycastWorker::InternalRaycastResult> results;
+            internalRequest.occupancy = nullptr;
+            internalRequest.visibility = nullptr;
+            internalRequest.layout = mapLayout_;
             internalRequest.requestId = request->request_id();
             internalRequest.playerId = request->player_id();
             internalRequest.player.x = request->player().x();
@@ -62,33 +343,125 @@ public:
             internalRequest.fov = request->fov();
             internalRequest.startColumn = request->start_column();
             internalRequest.endColumn = request->end_column();
-            internalRequest.mapWidth = request->map_width();
-            internalRequest.mapHeight = request->map_height();
-            
-            // Convert map data
-            for (int y = 0; y < request->map_height(); y++) {
-                std::vector<int> row;
-                for (int x = 0; x < request->map_width(); x++) {
-                    row.push_back(request->map(y * request->map_width() + x));
+            switch (request->precision()) {
+                case RaycastWorker::PRECISION_FLOAT:
+                    internalRequest.precision = RaycastWorker::RenderPrecision::FLOAT;
+                    break;
+                case RaycastWorker::PRECISION_FIXED_16_16:
+                    internalRequest.precision = RaycastWorker::RenderPrecision::FIXED_16_16;
+                    break;
+                default:
+                    internalRequest.precision = RaycastWorker::RenderPrecision::DOUBLE;
+                    break;
+            }
+
+            // Maps uploaded earlier are referenced by content hash; otherwise the map comes inline
+            std::shared_ptr<const RaycastWorker::CachedMap> cachedMap;
+            std::shared_ptr<const RaycastWorker::VisibilitySet> visibility;
+            std::shared_lock<std::shared_mutex> mapLock;
+            if (request->map_size() == 0 && request->map_encoding() == RaycastWorker::MAP_ENCODING_NONE &&
+                !request->map_id().empty()) {
+                cachedMap = mapCache_.find(request->map_id());
+                if (!cachedMap) {
+                    activeJobs_--;
+                    status_.activeJobs.store(activeJobs_.load());
+                    return Status(grpc::StatusCode::NOT_FOUND, "Map not cached: " + request->map_id());
+                }
+                // Deltas edit the map in place, so it stays locked until the columns are done
+                mapLock = std::shared_lock<std::shared_mutex>(cachedMap->mutex);
+                if (request->map_version() != 0 && request->map_version() != cachedMap->version) {
+                    activeJobs_--;
+                    status_.activeJobs.store(activeJobs_.load());
+                    return versionMismatch(cachedMap->id, cachedMap->version);
                 }
-                internalRequest.map.push_back(row);
+                internalRequest.map = cachedMap->view();
+                internalRequest.occupancy = &cachedMap->grid;
+                visibility = cachedMap->visibleSet();
+                internalRequest.visibility = visibility.get();
+            } else if (request->map_encoding() != RaycastWorker::MAP_ENCODING_NONE) {
+                // Compact maps decode straight into occupancy bits; the cells are never expanded
+                thread_local std::string expanded;
+                thread_local RaycastWorker::OccupancyGrid inlineGrid;
+                auto encoding = static_cast<MapCellEncoding>(request->map_encoding());
+                const uint8_t* cells = mapCellData(request->map_cells(), encoding, request->map_cells_compressed(),
+                                                   request->map_width(), request->map_height(), expanded);
+                if (!cells) {
+                    activeJobs_--;
+                    status_.activeJobs.store(activeJobs_.load());
+                    return Status(grpc::StatusCode::INVALID_ARGUMENT, "Malformed map_cells");
+                }
+                inlineGrid.setLayout(mapLayout_);
+                if (encoding == MapCellEncoding::BITSET) {
+                    inlineGrid.buildFromBitset(request->map_width(), request->map_height(), cells);
+                } else {
+                    inlineGrid.buildFromBytes(request->map_width(), request->map_height(), cells);
+                }
+                internalRequest.map = RaycastWorker::MapView(nullptr, request->map_width(), request->map_height());
+                internalRequest.occupancy = &inlineGrid;
+            } else {
+                // Wrap the request's map storage directly instead of copying it
+                if (request->map_width() < 0 || request->map_height() < 0 ||
+                    static_cast<int64_t>(request->map_size()) <
+                        static_cast<int64_t>(request->map_width()) * request->map_height()) {
+                    activeJobs_--;
+                    status_.activeJobs.store(activeJobs_.load());
+                    return Status(grpc::StatusCode::INVALID_ARGUMENT, "Map data smaller than map dimensions");
+                }
+                internalRequest.map = RaycastWorker::MapView(request->map().data(),
+                                                             request->map_width(), request->map_height());
             }
-            
+
             // Process raycasting
-            auto results = RaycastWorker::RaycastEngine::renderColumns(internalRequest);
+            RaycastWorker::RaycastEngine::renderColumns(internalRequest, splitRenders_ ? renderPool_.get() : nullptr,
+                                                        minChunkColumns_, results);
+            if (mapLock) {
+                mapLock.unlock();
+            }
+            
+            // Convert results back to protobuf, as one packed buffer if the caller asked for it
+            if (request->result_encoding() == RaycastWorker::RESULT_ENCODING_COLUMNAR) {
+                int count = static_cast<int>(results.size());
+                std::string* planes = response->mutable_columns();
+                resizeColumnPlanes(*planes, count);
+                for (int i = 0; i < count; i++) {
+                    const auto& result = results[i];
+                    putColumn(*planes, count, i, {static_cast<float>(result.distance), result.wallX, result.wallType,
+                                                  result.wallTop, result.wallBottom, result.r, result.g, result.b});
+                }
+                response->set_result_encoding(RaycastWorker::RESULT_ENCODING_COLUMNAR);
+                response->set_start_column(internalRequest.startColumn);
+                response->set_column_count(count);
+            } else {
+                for (const auto& result : results) {
+                    auto* protoResult = response->add_results();
+                    protoResult->set_column(result.column);
+                    protoResult->set_distance(result.distance);
+                    protoResult->set_wall_type(result.wallType);
+                    protoResult->set_wall_x(result.wallX);
+                    protoResult->set_wall_top(result.wallTop);
+                    protoResult->set_wall_bottom(result.wallBottom);
+                    protoResult->set_r(result.r);
+                    protoResult->set_g(result.g);
+                    protoResult->set_b(result.b);
+                }
+            }
             
-            // Convert results back to protobuf
-            for (const auto& result : results) {
-                auto* protoResult = response->add_results();
-                protoResult->set_column(result.column);
-                protoResult->set_distance(result.distance);
-                protoResult->set_wall_type(result.wallType);
-                protoResult->set_wall_x(result.wallX);
-                protoResult->set_wall_top(result.wallTop);
-                protoResult->set_wall_bottom(result.wallBottom);
-                protoResult->set_r(result.r);
-                protoResult->set_g(result.g);
-                protoResult->set_b(result.b);
+            // Step counts summed per bucket; consecutive columns fill each bucket in turn
+            int bucketColumns = request->step_bucket_columns();
+            if (bucketColumns > 0 && !results.empty()) {
+                std::string* steps = response->mutable_column_steps();
+                int bucket = stepBucketOf(results.front().column, bucketColumns);
+                uint64_t bucketSteps = 0;
+                for (const auto& result : results) {
+                    int resultBucket = stepBucketOf(result.column, bucketColumns);
+                    if (resultBucket != bucket) {
+                        appendStepBucket(*steps, bucketSteps);
+                        bucket = resultBucket;
+                        bucketSteps = 0;
+                    }
+                    bucketSteps += static_cast<uint64_t>(result.steps);
+                }
+                appendStepBucket(*steps, bucketSteps);
             }
             
             response->set_request_id(internalRequest.requestId);
@@ -107,6 +480,11 @@ public:
             status_.totalJobsProcessed.store(totalJobsProcessed_.load());
             status_.averageProcessingTimeMs = totalProcessingTime_.load() / totalJobsProcessed_.load();
             
+            int64_t allocations = static_cast<int64_t>(threadAllocationCount() - allocationsBefore);
+            lastRequestAllocations_ = allocations;
+            allocationsPerRequest_ = allocationsPerRequest_.load() +
+                                     ALLOCATION_AVERAGE_WEIGHT * (allocations - allocationsPerRequest_.load());
+            
         } catch (const std::exception& e) {
             std::cerr << "Error processing request: " << e.what() << std::endl;
             return Status(grpc::StatusCode::INTERNAL, "Internal processing error");
@@ -121,36 +499,251 @@ public:
         return Status::OK;
     }
     
-    Status GetWorkerStatus(ServerContext* context, 
-                          const RaycastWorker::StatusRequest* request,
-                          RaycastWorker::WorkerStatus* response) override {
+private:
+    // FAILED_PRECONDITION carrying the version this worker has, so the caller can catch it up
+    static Status versionMismatch(const std::string& mapId, uint64_t currentVersion) {
+        RaycastWorker::MapVersionMismatch details;
+        details.set_map_id(mapId);
+        details.set_current_version(currentVersion);
+        return Status(grpc::StatusCode::FAILED_PRECONDITION,
+                      "Map " + mapId + " is at version " + std::to_string(currentVersion),
+                      details.SerializeAsString());
+    }
+};
+
+// How the gRPC server is run; see ENVIRONMENT_SETUP.md for the matching variables
+struct WorkerServerConfig {
+    bool async = false;             // Completion-queue server instead of gRPC's own threads
+    int completionQueues = 1;       // One per core, each drained by its own thread
+    int maxConcurrentStreams = 0;   // Per connection; 0 keeps gRPC's default
+    size_t resourceQuotaBytes = 0;  // Memory gRPC may use for buffers; 0 is unlimited
+    int maxThreads = 0;             // Threads gRPC may create; 0 is unlimited
+};
+
+// Completion-queue server: every call is accepted on one of several queues, and the
+// thread draining that queue runs the handler too, so there is one busy thread per core
+// and no threads are created or handed work per call.
+class AsyncWorkerServer {
+private:
+    // Unary methods come through the queues. Sessions are long-lived and mostly idle, so they
+    // stay on the callback API rather than holding a queue thread each.
+    using AsyncMethods = RaycastWorker::WorkerService::WithAsyncMethod_ProcessRenderRequest<
+        RaycastWorker::WorkerService::WithAsyncMethod_GetWorkerStatus<
+        RaycastWorker::WorkerService::WithAsyncMethod_UploadMap<
+        RaycastWorker::WorkerService::WithAsyncMethod_ApplyMapDelta<
+        RaycastWorker::WorkerService::WithCallbackMethod_RenderSession<RaycastWorker::WorkerService::Service>>>>>;
+    
+    class AsyncService final : public AsyncMethods {
+    private:
+        RaycastWorkerServiceImpl& handlers_;
         
-        response->set_worker_id(status_.workerId);
-        response->set_status(status_.status);
-        response->set_active_jobs(status_.activeJobs.load());
-        response->set_total_jobs_processed(status_.totalJobsProcessed.load());
-        response->set_average_processing_time_ms(status_.averageProcessingTimeMs);
-        response->set_last_heartbeat(status_.lastHeartbeat);
+    public:
+        explicit AsyncService(RaycastWorkerServiceImpl& handlers) : handlers_(handlers) {}
         
-        return Status::OK;
+        grpc::ServerBidiReactor<RaycastWorker::RenderSessionRequest, RaycastWorker::RenderSessionResponse>*
+        RenderSession(grpc::CallbackServerContext* context) override {
+            return handlers_.RenderSession(context);
+        }
+    };
+    
+    // A call in flight, passed through the queue as its tag
+    class Call {
+    public:
+        virtual ~Call() = default;
+        virtual void proceed(bool ok) = 0;
+    };
+    
+    template <typename Request, typename Response>
+    class UnaryCall final : public Call {
+    public:
+        using RequestMethod = void (AsyncService::*)(ServerContext*, Request*,
+                                                     grpc::ServerAsyncResponseWriter<Response>*,
+                                                     grpc::CompletionQueue*, grpc::ServerCompletionQueue*, void*);
+        using Handler = std::function<Status(ServerContext*, const Request*, Response*)>;
+        
+    private:
+        AsyncService* service_;
+        grpc::ServerCompletionQueue* queue_;
+        RequestMethod method_;
+        const Handler* handler_;
+        ServerContext context_;
+        google::protobuf::Arena arena_;
+        Request* request_;
+        Response* response_;
+        grpc::ServerAsyncResponseWriter<Response> responder_;
+        bool finishing_;
+        
+    public:
+        UnaryCall(AsyncService* service, grpc::ServerCompletionQueue* queue, RequestMethod method,
+                  const Handler* handler)
+            : service_(service), queue_(queue), method_(method), handler_(handler),
+              request_(google::protobuf::Arena::CreateMessage<Request>(&arena_)),
+              response_(google::protobuf::Arena::CreateMessage<Response>(&arena_)),
+              responder_(&context_), finishing_(false) {
+            (service_->*method_)(&context_, request_, &responder_, queue_, queue_, this);
+        }
+        
+        void proceed(bool ok) override {
+            // Not ok before finishing means the server is shutting down
+            if (finishing_ || !ok) {
+                delete this;
+                return;
+            }
+            // Accept the next call of this kind on this queue before handling this one
+            new UnaryCall(service_, queue_, method_, handler_);
+            finishing_ = true;
+            responder_.Finish(*response_, (*handler_)(&context_, request_, response_), this);
+        }
+    };
+    
+    RaycastWorkerServiceImpl& handlers_;
+    AsyncService service_;
+    std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> queues_;
+    UnaryCall<RaycastWorker::RenderRequest, RaycastWorker::RenderResponse>::Handler render_;
+    UnaryCall<RaycastWorker::StatusRequest, RaycastWorker::WorkerStatus>::Handler status_;
+    UnaryCall<RaycastWorker::UploadMapRequest, RaycastWorker::UploadMapResponse>::Handler uploadMap_;
+    UnaryCall<RaycastWorker::MapDeltaRequest, RaycastWorker::MapDeltaResponse>::Handler applyMapDelta_;
+    
+public:
+    explicit AsyncWorkerServer(RaycastWorkerServiceImpl& handlers) : handlers_(handlers), service_(handlers) {
+        render_ = [this](ServerContext*, const RaycastWorker::RenderRequest* request,
+                         RaycastWorker::RenderResponse* response) {
+            return handlers_.renderRequest(request, response);
+        };
+        status_ = [this](ServerContext* context, const RaycastWorker::StatusRequest* request,
+                         RaycastWorker::WorkerStatus* response) {
+            return handlers_.GetWorkerStatus(context, request, response);
+        };
+        uploadMap_ = [this](ServerContext* context, const RaycastWorker::UploadMapRequest* request,
+                            RaycastWorker::UploadMapResponse* response) {
+            return handlers_.UploadMap(context, request, response);
+        };
+        applyMapDelta_ = [this](ServerContext* context, const RaycastWorker::MapDeltaRequest* request,
+                                RaycastWorker::MapDeltaResponse* response) {
+            return handlers_.ApplyMapDelta(context, request, response);
+        };
+    }
+    
+    // Registers the service and one queue per shard; call before BuildAndStart
+    void configure(ServerBuilder& builder, int numQueues) {
+        builder.RegisterService(&service_);
+        for (int i = 0; i < std::max(numQueues, 1); i++) {
+            queues_.push_back(builder.AddCompletionQueue());
+        }
+    }
+    
+    // Drains every queue on its own thread until the server shuts down
+    void run() {
+        std::vector<std::thread> threads;
+        for (auto& queue : queues_) {
+            grpc::ServerCompletionQueue* cq = queue.get();
+            new UnaryCall<RaycastWorker::RenderRequest, RaycastWorker::RenderResponse>(
+                &service_, cq, &AsyncService::RequestProcessRenderRequest, &render_);
+            new UnaryCall<RaycastWorker::StatusRequest, RaycastWorker::WorkerStatus>(
+                &service_, cq, &AsyncService::RequestGetWorkerStatus, &status_);
+            new UnaryCall<RaycastWorker::UploadMapRequest, RaycastWorker::UploadMapResponse>(
+                &service_, cq, &AsyncService::RequestUploadMap, &uploadMap_);
+            new UnaryCall<RaycastWorker::MapDeltaRequest, RaycastWorker::MapDeltaResponse>(
+                &service_, cq, &AsyncService::RequestApplyMapDelta, &applyMapDelta_);
+            
+            threads.emplace_back([cq] {
+                void* tag;
+                bool ok;
+                while (cq->Next(&tag, &ok)) {
+                    static_cast<Call*>(tag)->proceed(ok);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    
+    // After Server::Shutdown, so the queues drain and run() returns
+    void shutdown() {
+        for (auto& queue : queues_) {
+            queue->Shutdown();
+        }
     }
 };
 
-void RunWorker(int workerId, const std::string& serverAddress) {
-    RaycastWorkerServiceImpl service(workerId);
+// How long calls in flight get to finish on shutdown before they are cancelled
+constexpr auto SHUTDOWN_GRACE_PERIOD = std::chrono::seconds(5);
+
+// Signals that shut the worker down. main blocks them before any thread starts, so every
+// thread inherits the mask and only RunWorker's signal thread receives them.
+sigset_t shutdownSignals() {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    return signals;
+}
+
+void RunWorker(int workerId, const std::string& serverAddress, int renderThreads, int minChunkColumns,
+               size_t mapCacheBytes, RaycastWorker::CellLayout mapLayout, const WorkerServerConfig& config) {
+    RaycastWorkerServiceImpl service(workerId, renderThreads, minChunkColumns, mapCacheBytes, mapLayout,
+                                     config.async);
+    AsyncWorkerServer asyncServer(service);
     
     ServerBuilder builder;
     builder.AddListeningPort(serverAddress, grpc::InsecureServerCredentials());
-    builder.RegisterService(&service);
+    if (config.maxConcurrentStreams > 0) {
+        builder.AddChannelArgument(GRPC_ARG_MAX_CONCURRENT_STREAMS, config.maxConcurrentStreams);
+    }
+    if (config.resourceQuotaBytes > 0 || config.maxThreads > 0) {
+        grpc::ResourceQuota quota("raycast-worker");
+        if (config.resourceQuotaBytes > 0) {
+            quota.Resize(config.resourceQuotaBytes);
+        }
+        if (config.maxThreads > 0) {
+            quota.SetMaxThreads(config.maxThreads);
+        }
+        builder.SetResourceQuota(quota);
+    }
+    if (config.async) {
+        asyncServer.configure(builder, config.completionQueues);
+    } else {
+        builder.RegisterService(&service);
+    }
     
     std::unique_ptr<Server> server(builder.BuildAndStart());
-    std::cout << "Worker " << workerId << " listening on " << serverAddress << std::endl;
+    if (!server) {
+        std::cerr << "Worker " << workerId << " failed to listen on " << serverAddress << std::endl;
+        return;
+    }
+    std::cout << "Worker " << workerId << " listening on " << serverAddress;
+    if (config.async) {
+        std::cout << " with " << config.completionQueues << " completion queues";
+    }
+    std::cout << std::endl;
+    
+    // Stop accepting calls on a shutdown signal, then let the completion queues drain
+    std::thread signalThread([&] {
+        sigset_t signals = shutdownSignals();
+        int signal = 0;
+        sigwait(&signals, &signal);
+        std::cout << "\nReceived signal " << signal << ", shutting down..." << std::endl;
+        server->Shutdown(std::chrono::system_clock::now() + SHUTDOWN_GRACE_PERIOD);
+        if (config.async) {
+            asyncServer.shutdown();
+        }
+    });
     
     // Keep the server running
-    server->Wait();
+    if (config.async) {
+        asyncServer.run();
+    } else {
+        server->Wait();
+    }
+    signalThread.join();
+    std::cout << "Worker " << workerId << " stopped" << std::endl;
 }
 
 int main(int argc, char** argv) {
+    sigset_t signals = shutdownSignals();
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    
     int workerId = 1;
     std::string serverAddress = "0.0.0.0:50051";
     
@@ -170,6 +763,58 @@ int main(int argc, char** argv) {
         serverAddress = envServerAddress;
     }
     
+    // "callback" lets gRPC run the calls; "async" serves them from one completion queue per core
+    WorkerServerConfig serverConfig;
+    int cpus = RaycastWorker::availableCpuCount();
+    const char* envServerMode = std::getenv("WORKER_SERVER_MODE");
+    serverConfig.async = envServerMode != nullptr && std::string(envServerMode) == "async";
+    serverConfig.completionQueues = cpus;
+    const char* envCompletionQueues = std::getenv("WORKER_COMPLETION_QUEUES");
+    if (envCompletionQueues != nullptr) {
+        serverConfig.completionQueues = std::atoi(envCompletionQueues);
+    }
+    const char* envMaxStreams = std::getenv("WORKER_MAX_CONCURRENT_STREAMS");
+    if (envMaxStreams != nullptr) {
+        serverConfig.maxConcurrentStreams = std::atoi(envMaxStreams);
+    }
+    const char* envQuotaBytes = std::getenv("WORKER_RESOURCE_QUOTA_BYTES");
+    if (envQuotaBytes != nullptr) {
+        serverConfig.resourceQuotaBytes = std::strtoull(envQuotaBytes, nullptr, 10);
+    }
+    const char* envMaxThreads = std::getenv("WORKER_MAX_THREADS");
+    if (envMaxThreads != nullptr) {
+        serverConfig.maxThreads = std::atoi(envMaxThreads);
+    }
+    
+    // Threads used to render a single request, and the smallest column range worth splitting.
+    // The async server already keeps every core busy with its own requests, so it renders each
+    // request on one thread unless told otherwise.
+    int renderThreads = serverConfig.async ? 1 : cpus;
+    const char* envRenderThreads = std::getenv("RENDER_THREADS");
+    if (envRenderThreads != nullptr) {
+        renderThreads = std::atoi(envRenderThreads);
+    }
+    
+    int minChunkColumns = 128;
+    const char* envMinChunk = std::getenv("RENDER_MIN_CHUNK_COLUMNS");
+    if (envMinChunk != nullptr) {
+        minChunkColumns = std::atoi(envMinChunk);
+    }
+    
+    // Memory budget for maps uploaded with UploadMap, including their derived data
+    size_t mapCacheBytes = 256ull << 20;
+    const char* envMapCacheBytes = std::getenv("MAP_CACHE_BYTES");
+    if (envMapCacheBytes != nullptr) {
+        mapCacheBytes = std::strtoull(envMapCacheBytes, nullptr, 10);
+    }
+    
+    // Order of the wall bits rays test cell by cell: "row_major" or "tiled" (8x8 cells per word)
+    RaycastWorker::CellLayout mapLayout = RaycastWorker::CellLayout::ROW_MAJOR;
+    const char* envMapLayout = std::getenv("MAP_LAYOUT");
+    if (envMapLayout != nullptr && std::string(envMapLayout) == "tiled") {
+        mapLayout = RaycastWorker::CellLayout::TILED;
+    }
+    
     if (argc > 1) {
         workerId = std::atoi(argv[1]);
     }
@@ -179,6 +824,6 @@ int main(int argc, char** argv) {
     
     std::cout << "Starting Raycast Worker " << workerId << " on " << serverAddress << std::endl;
     
-    RunWorker(workerId, serverAddress);
+    RunWorker(workerId, serverAddress, renderThreads, minChunkColumns, mapCacheBytes, mapLayout, serverConfig);
     return 0;
 }
\ No newline at end of file